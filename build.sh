@@ -2,4 +2,6 @@
 
 set -xe
 
-gcc -o tilemap_editor src/main.c src/tilemap.c src/file_picker.c -lm -lraylib ./libimgui.a -lstdc++
+gcc -o tilemap_editor src/main.c src/tilemap.c src/atlas.c src/tile_renderer.c src/static_index.c src/tilemap_file.c src/qoi.c src/parallel.c src/trace.c src/async_save.c src/async_load.c src/async_import.c src/history.c src/brush.c src/fill.c src/profiler.c src/file_picker.c -lm -lpthread -lraylib ./libimgui.a -lstdc++
+gcc -o tilemap_cli src/cli.c src/tilemap.c src/atlas.c src/tile_renderer.c src/static_index.c src/tilemap_file.c src/qoi.c src/parallel.c src/trace.c -lm -lpthread -lraylib
+gcc -o tilemap_bench src/bench.c src/tilemap.c src/atlas.c src/tile_renderer.c src/static_index.c src/tilemap_file.c src/qoi.c src/parallel.c src/trace.c -lm -lpthread -lraylib
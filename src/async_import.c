@@ -0,0 +1,97 @@
+#include "async_import.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static void report_progress(void* context, float progress)
+{
+	AsyncImport* import = context;
+	atomic_store(&import->progress, (int)(progress * 1000.0f));
+}
+
+static void* run_import(void* argument)
+{
+	AsyncImport* import = argument;
+
+	TRACE_BEGIN("async import");
+	import->result = import_tileset(import->filepath, import->width, import->height, &import->import, report_progress, import);
+	TRACE_END();
+
+	atomic_store(&import->finished, true);
+	return NULL;
+}
+
+static void collect(AsyncImport* import, TilesetImport* result, bool* success)
+{
+	if (import->threaded)
+		pthread_join(import->thread, NULL);
+	free(import->filepath);
+	import->filepath = NULL;
+	import->running = false;
+
+	*result = import->import;
+	import->import = (TilesetImport){0};
+	if (success)
+		*success = import->result;
+}
+
+bool async_import_start(AsyncImport* import, const char* filepath, int width, int height)
+{
+	if (!import || !filepath)
+		return false;
+
+	TilesetImport previous;
+	if (async_import_wait(import, &previous, NULL))
+		unload_tileset_import(&previous);
+
+	import->filepath = strdup(filepath);
+	if (!import->filepath)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return false;
+	}
+
+	import->width = width;
+	import->height = height;
+	import->import = (TilesetImport){0};
+	import->result = false;
+	atomic_store(&import->progress, 0);
+	atomic_store(&import->finished, false);
+	import->running = true;
+	import->threaded = pthread_create(&import->thread, NULL, run_import, import) == 0;
+
+	if (!import->threaded)
+	{
+		// Import on this thread instead, the result is collected by the next poll
+		fprintf(stderr, "WARNING: Could not start the import thread, importing synchronously\n");
+		run_import(import);
+	}
+
+	return true;
+}
+
+bool async_import_poll(AsyncImport* import, TilesetImport* result, bool* success)
+{
+	if (!import || !import->running || !atomic_load(&import->finished))
+		return false;
+
+	collect(import, result, success);
+	return true;
+}
+
+bool async_import_wait(AsyncImport* import, TilesetImport* result, bool* success)
+{
+	if (!import || !import->running)
+		return false;
+
+	collect(import, result, success);
+	return true;
+}
+
+float async_import_progress(const AsyncImport* import)
+{
+	return atomic_load(&import->progress) / 1000.0f;
+}
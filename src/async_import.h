@@ -0,0 +1,38 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "tilemap.h"
+
+// Imports a tileset on a worker thread: decoding and slicing happen there. add_tileset_import then
+// copies the tiles into the atlas on the thread owning the tilemap, and atlas_update uploads the
+// rows of the pages they changed.
+// All functions but async_import_progress must be called from the same thread.
+typedef struct
+{
+	pthread_t thread;
+	bool threaded; // false when the import ran on the calling thread
+	bool running; // Started and not collected by async_import_poll or async_import_wait yet
+
+	char* filepath;
+	int width;
+	int height;
+
+	// Written by the worker
+	TilesetImport import;
+	bool result;
+	atomic_int progress; // Thousandths of the cells done
+	atomic_bool finished;
+} AsyncImport;
+
+// Starts importing filepath, waits for (and discards) the previous import first if it is still running
+bool async_import_start(AsyncImport* import, const char* filepath, int width, int height);
+// Returns true once after the import finished, the tiles (none when it failed) are moved to *result
+// and *success tells whether it succeeded
+bool async_import_poll(AsyncImport* import, TilesetImport* result, bool* success);
+// Blocks until the running import is done, then works like async_import_poll (false when none was running)
+bool async_import_wait(AsyncImport* import, TilesetImport* result, bool* success);
+// Fraction of the cells done, from 0 to 1
+float async_import_progress(const AsyncImport* import);
@@ -0,0 +1,84 @@
+#include "async_load.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tilemap_file.h"
+#include "trace.h"
+
+static void* run_load(void* argument)
+{
+	AsyncLoad* load = argument;
+
+	TRACE_BEGIN("async load");
+	load->result = load_tilemap_file(load->filepath, &load->tilemap, NULL);
+	TRACE_END();
+
+	atomic_store(&load->finished, true);
+	return NULL;
+}
+
+static void collect(AsyncLoad* load, Tilemap* tilemap, bool* result)
+{
+	if (load->threaded)
+		pthread_join(load->thread, NULL);
+	free(load->filepath);
+	load->filepath = NULL;
+	load->running = false;
+
+	*tilemap = load->tilemap;
+	load->tilemap = (Tilemap){0};
+	if (result)
+		*result = load->result;
+}
+
+bool async_load_start(AsyncLoad* load, const char* filepath)
+{
+	if (!load || !filepath)
+		return false;
+
+	Tilemap previous;
+	if (async_load_wait(load, &previous, NULL))
+		unload_tilemap(&previous);
+
+	load->filepath = strdup(filepath);
+	if (!load->filepath)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return false;
+	}
+
+	load->tilemap = (Tilemap){0};
+	load->result = false;
+	atomic_store(&load->finished, false);
+	load->running = true;
+	load->threaded = pthread_create(&load->thread, NULL, run_load, load) == 0;
+
+	if (!load->threaded)
+	{
+		// Load on this thread instead, the result is collected by the next poll
+		fprintf(stderr, "WARNING: Could not start the load thread, loading synchronously\n");
+		run_load(load);
+	}
+
+	return true;
+}
+
+bool async_load_poll(AsyncLoad* load, Tilemap* tilemap, bool* result)
+{
+	if (!load || !load->running || !atomic_load(&load->finished))
+		return false;
+
+	collect(load, tilemap, result);
+	return true;
+}
+
+bool async_load_wait(AsyncLoad* load, Tilemap* tilemap, bool* result)
+{
+	if (!load || !load->running)
+		return false;
+
+	collect(load, tilemap, result);
+	return true;
+}
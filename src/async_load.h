@@ -0,0 +1,32 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "tilemap.h"
+
+// Loads a tilemap file on a worker thread: parsing, image decoding and atlas packing happen
+// there, the pages are uploaded by atlas_update on the GPU thread once the tilemap is taken.
+// All functions must be called from the same thread.
+typedef struct
+{
+	pthread_t thread;
+	bool threaded; // false when the load ran on the calling thread
+	bool running; // Started and not collected by async_load_poll or async_load_wait yet
+
+	char* filepath;
+
+	// Written by the worker
+	Tilemap tilemap;
+	bool result;
+	atomic_bool finished;
+} AsyncLoad;
+
+// Starts loading filepath, waits for (and discards) the previous load first if it is still running
+bool async_load_start(AsyncLoad* load, const char* filepath);
+// Returns true once after the load finished, the loaded tilemap (empty when loading failed)
+// is moved to *tilemap and *result tells whether it succeeded
+bool async_load_poll(AsyncLoad* load, Tilemap* tilemap, bool* result);
+// Blocks until the running load is done, then works like async_load_poll (false when none was running)
+bool async_load_wait(AsyncLoad* load, Tilemap* tilemap, bool* result);
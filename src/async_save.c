@@ -0,0 +1,101 @@
+#include "async_save.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tilemap_file.h"
+
+static void report_progress(void* context, float progress)
+{
+	AsyncSave* save = context;
+	atomic_store(&save->progress, (int)(progress * 1000.0f));
+}
+
+static void* run_save(void* argument)
+{
+	AsyncSave* save = argument;
+
+	save->result = save_tilemap_with_progress(&save->snapshot, save->filepath, report_progress, save);
+	unload_tilemap_snapshot(&save->snapshot);
+
+	atomic_store(&save->finished, true);
+	return NULL;
+}
+
+static bool collect(AsyncSave* save)
+{
+	pthread_join(save->thread, NULL);
+	free(save->filepath);
+	save->filepath = NULL;
+	save->running = false;
+
+	return save->result;
+}
+
+bool async_save_start(AsyncSave* save, const Tilemap* tilemap, const char* filepath)
+{
+	if (!save || !tilemap || !filepath)
+		return false;
+
+	async_save_wait(save);
+
+	save->filepath = strdup(filepath);
+	if (!save->filepath)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return false;
+	}
+
+	if (!snapshot_tilemap(tilemap, &save->snapshot))
+	{
+		// Without a complete snapshot the worker would save missing parts as empty
+		fprintf(stderr, "WARNING: Could not copy the tilemap for the save thread, saving synchronously\n");
+		bool result = save_tilemap(tilemap, save->filepath);
+		free(save->filepath);
+		save->filepath = NULL;
+		return result;
+	}
+
+	save->result = false;
+	atomic_store(&save->progress, 0);
+	atomic_store(&save->finished, false);
+
+	if (pthread_create(&save->thread, NULL, run_save, save) != 0)
+	{
+		// Save on this thread instead
+		fprintf(stderr, "WARNING: Could not start the save thread, saving synchronously\n");
+		run_save(save);
+		free(save->filepath);
+		save->filepath = NULL;
+		return save->result;
+	}
+
+	save->running = true;
+	return true;
+}
+
+bool async_save_poll(AsyncSave* save, bool* result)
+{
+	if (!save || !save->running || !atomic_load(&save->finished))
+		return false;
+
+	bool success = collect(save);
+	if (result)
+		*result = success;
+
+	return true;
+}
+
+bool async_save_wait(AsyncSave* save)
+{
+	if (!save || !save->running)
+		return true;
+
+	return collect(save);
+}
+
+float async_save_progress(const AsyncSave* save)
+{
+	return atomic_load(&save->progress) / 1000.0f;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "tilemap.h"
+
+// Saves a snapshot of the tilemap on a worker thread so editing goes on during the save.
+// All functions must be called from the thread owning the tilemap.
+typedef struct
+{
+	pthread_t thread;
+	bool running; // Started and not collected by async_save_poll or async_save_wait yet
+
+	Tilemap snapshot;
+	char* filepath;
+
+	// Written by the worker
+	atomic_int progress; // Per mille
+	atomic_bool finished;
+	bool result;
+} AsyncSave;
+
+// Starts saving tilemap to filepath, waits for the previous save first if it is still running
+bool async_save_start(AsyncSave* save, const Tilemap* tilemap, const char* filepath);
+// Returns true once after the save finished, *result tells whether it succeeded
+bool async_save_poll(AsyncSave* save, bool* result);
+// Blocks until the running save is done, returns its result (true when nothing was running)
+bool async_save_wait(AsyncSave* save);
+// Fraction of the running save done so far
+float async_save_progress(const AsyncSave* save);
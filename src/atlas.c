@@ -0,0 +1,472 @@
+#include "atlas.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <raylib.h>
+
+#include "parallel.h"
+#include "trace.h"
+#include "utils.h"
+
+static void mark_dirty(AtlasPage* page, int top, int bottom)
+{
+	if (!page->dirty || top < page->dirty_top)
+		page->dirty_top = top;
+	if (!page->dirty || bottom > page->dirty_bottom)
+		page->dirty_bottom = bottom;
+	page->dirty = true;
+}
+
+static AtlasPage* atlas_new_page(Atlas* atlas, int min_width, int min_height)
+{
+	int size = ATLAS_PAGE_SIZE;
+	while (size < min_width || size < min_height)
+		size *= 2;
+
+	AtlasPage* page = calloc(1, sizeof(AtlasPage));
+	if (!page)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return NULL;
+	}
+
+	page->image = GenImageColor(size, size, BLANK);
+	mark_dirty(page, 0, size);
+	da_append(*atlas, page);
+
+	return page;
+}
+
+// Finds space for a width x height block on the page, shelves are never revisited
+static bool page_allocate(AtlasPage* page, int width, int height, int* x, int* y)
+{
+	if (page->shelf_x + width > page->image.width)
+	{
+		page->shelf_x = 0;
+		page->shelf_y += page->shelf_height;
+		page->shelf_height = 0;
+	}
+
+	if (page->shelf_x + width > page->image.width || page->shelf_y + height > page->image.height)
+		return false;
+
+	*x = page->shelf_x;
+	*y = page->shelf_y;
+
+	page->shelf_x += width;
+	if (height > page->shelf_height)
+		page->shelf_height = height;
+
+	return true;
+}
+
+// Alpha weighted average of the pixels of area on an R8G8B8A8 image
+static Color get_average_color(Image rgba, Rectangle area)
+{
+	const Color* pixels = rgba.data;
+	size_t count = (size_t)area.width * (size_t)area.height;
+	if (count == 0)
+		return BLANK;
+
+	uint64_t r = 0, g = 0, b = 0, a = 0;
+	for (int y = (int)area.y; y < (int)(area.y + area.height); y++)
+	{
+		const Color* row = pixels + (size_t)y * rgba.width;
+		for (int x = (int)area.x; x < (int)(area.x + area.width); x++)
+		{
+			r += row[x].r * row[x].a;
+			g += row[x].g * row[x].a;
+			b += row[x].b * row[x].a;
+			a += row[x].a;
+		}
+	}
+
+	if (a == 0)
+		return BLANK;
+
+	Color result =
+	{
+		.r = r / a,
+		.g = g / a,
+		.b = b / a,
+		.a = a / count,
+	};
+
+	return result;
+}
+
+static void copy_pixel(Image* page, int to_x, int to_y, int from_x, int from_y)
+{
+	Color* pixels = page->data;
+	pixels[to_y * page->width + to_x] = pixels[from_y * page->width + from_x];
+}
+
+// Reserves a width x height block in the last page, or in a new one when it is full
+static bool atlas_allocate(Atlas* atlas, int width, int height, size_t* page_index, int* x, int* y)
+{
+	// Only the last page has free shelves
+	if (atlas->size > 0 && page_allocate(atlas->items[atlas->size - 1], width, height, x, y))
+	{
+		*page_index = atlas->size - 1;
+		return true;
+	}
+
+	AtlasPage* page = atlas_new_page(atlas, width, height);
+	if (!page || !page_allocate(page, width, height, x, y))
+		return false;
+
+	*page_index = atlas->size - 1;
+	return true;
+}
+
+typedef struct
+{
+	Atlas* atlas;
+	Image rgba;
+	const Rectangle* areas;
+	AtlasRegion* regions;
+} AreaCopies;
+
+// Copies an area to its region and extrudes the edges into the padding,
+// only the block of the region is touched
+static void copy_area_job(void* context, size_t index)
+{
+	AreaCopies* copies = context;
+	Rectangle area = copies->areas[index];
+	AtlasRegion* region = &copies->regions[index];
+	Image* page = &copies->atlas->items[region->page]->image;
+
+	int left = (int)region->source.x;
+	int top = (int)region->source.y;
+	int width = (int)area.width;
+	int height = (int)area.height;
+	const Color* source = copies->rgba.data;
+	Color* pixels = page->data;
+	for (int j = 0; j < height; j++)
+	{
+		const Color* from = source + ((size_t)area.y + j) * copies->rgba.width + (size_t)area.x;
+		memcpy(pixels + (size_t)(top + j) * page->width + left, from, (size_t)width * sizeof(Color));
+	}
+
+	region->average = get_average_color(*page, region->source);
+
+	int right = left + width - 1;
+	int bottom = top + height - 1;
+	for (int p = 1; p <= ATLAS_PADDING; p++)
+	{
+		for (int j = top; j <= bottom; j++)
+		{
+			copy_pixel(page, left - p, j, left, j);
+			copy_pixel(page, right + p, j, right, j);
+		}
+
+		for (int i = left - ATLAS_PADDING; i <= right + ATLAS_PADDING; i++)
+		{
+			copy_pixel(page, i, top - p, i, top);
+			copy_pixel(page, i, bottom + p, i, bottom);
+		}
+	}
+}
+
+bool atlas_add_image_areas(Atlas* atlas, Image rgba, const Rectangle* areas, size_t count, AtlasRegion* regions)
+{
+	if (!atlas || !regions || !IsImageReady(rgba) || rgba.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8)
+		return false;
+
+	// Placing the areas is sequential, copying them is not: every block belongs to one area
+	for (size_t i = 0; i < count; i++)
+	{
+		Rectangle area = areas[i];
+		if (area.x < 0 || area.y < 0 || area.width < 1 || area.height < 1 ||
+			area.x + area.width > rgba.width || area.y + area.height > rgba.height)
+			return false;
+
+		int x = 0;
+		int y = 0;
+		size_t page = 0;
+		if (!atlas_allocate(atlas, (int)area.width + 2 * ATLAS_PADDING, (int)area.height + 2 * ATLAS_PADDING, &page, &x, &y))
+			return false;
+
+		regions[i].page = page;
+		regions[i].source = (Rectangle){ x + ATLAS_PADDING, y + ATLAS_PADDING, area.width, area.height };
+		mark_dirty(atlas->items[page], y, y + (int)area.height + 2 * ATLAS_PADDING);
+		atlas->items[page]->region_count++;
+	}
+
+	AreaCopies copies = { .atlas = atlas, .rgba = rgba, .areas = areas, .regions = regions };
+	parallel_for(count, copy_area_job, &copies);
+
+	return true;
+}
+
+bool atlas_add_image(Atlas* atlas, Image image, AtlasRegion* region)
+{
+	if (!atlas || !region || !IsImageReady(image))
+		return false;
+
+	Image rgba = ImageCopy(image);
+	ImageFormat(&rgba, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+	Rectangle area = { 0.0f, 0.0f, image.width, image.height };
+	bool result = atlas_add_image_areas(atlas, rgba, &area, 1, region);
+	UnloadImage(rgba);
+
+	return result;
+}
+
+Image atlas_get_image(const Atlas* atlas, AtlasRegion region)
+{
+	return ImageFromImage(atlas->items[region.page]->image, region.source);
+}
+
+const Texture2D* atlas_get_texture(const Atlas* atlas, AtlasRegion region)
+{
+	return &atlas->items[region.page]->texture;
+}
+
+size_t atlas_update(Atlas* atlas, size_t max_uploads)
+{
+	if (!atlas)
+		return 0;
+
+	size_t uploads = 0;
+	size_t waiting = 0;
+	for (size_t i = 0; i < atlas->size; i++)
+	{
+		AtlasPage* page = atlas->items[i];
+		if (!page->dirty)
+			continue;
+
+		if (max_uploads > 0 && uploads == max_uploads)
+		{
+			waiting++;
+			continue;
+		}
+		uploads++;
+
+		TRACE_BEGIN("upload atlas page");
+		// Regions are added shelf by shelf, the rows changed are usually a small band of the page
+		if (page->texture.id == 0)
+			page->texture = LoadTextureFromImage(page->image);
+		else
+		{
+			Rectangle rows = { 0.0f, page->dirty_top, page->image.width, page->dirty_bottom - page->dirty_top };
+			const Color* pixels = page->image.data;
+			UpdateTextureRec(page->texture, rows, pixels + (size_t)page->dirty_top * page->image.width);
+		}
+		TRACE_END();
+
+		page->dirty = false;
+		atlas->revision++;
+	}
+
+	return waiting;
+}
+
+static void release_page(AtlasPage* page)
+{
+	if (atomic_fetch_sub(&page->shares, 1) != 0)
+		return;
+
+	UnloadImage(page->image);
+	free(page);
+}
+
+// Drops the GPU texture, the image goes with the last owner
+static void unload_page(AtlasPage* page)
+{
+	if (page->texture.id != 0)
+		UnloadTexture(page->texture);
+	page->texture = (Texture2D){0};
+	release_page(page);
+}
+
+void atlas_unload(Atlas* atlas)
+{
+	if (!atlas)
+		return;
+
+	for (size_t i = 0; i < atlas->size; i++)
+		unload_page(atlas->items[i]);
+
+	free(atlas->items);
+	atlas->items = NULL;
+	atlas->size = 0;
+	atlas->capacity = 0;
+	atlas->revision++;
+}
+
+static int compare_region_positions(const void* a, const void* b)
+{
+	const AtlasRegion* left = *(const AtlasRegion* const*)a;
+	const AtlasRegion* right = *(const AtlasRegion* const*)b;
+	if (left->source.y != right->source.y)
+		return left->source.y < right->source.y ? -1 : 1;
+	if (left->source.x != right->source.x)
+		return left->source.x < right->source.x ? -1 : 1;
+
+	return 0;
+}
+
+// Copies of a region are next to each other once sorted, counts them once
+static size_t get_distinct_areas(AtlasRegion** regions, size_t count, Rectangle* areas)
+{
+	size_t distinct = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (i == 0 || compare_region_positions(&regions[i - 1], &regions[i]) != 0)
+			areas[distinct++] = regions[i]->source;
+	}
+
+	return distinct;
+}
+
+bool atlas_repack(Atlas* atlas, AtlasRegion* regions, size_t count)
+{
+	if (!atlas || atlas->size == 0)
+		return false;
+
+	size_t page_count = atlas->size;
+	size_t* first = calloc(page_count + 1, sizeof(size_t));
+	size_t* moved_to = malloc(page_count * sizeof(size_t));
+	AtlasRegion** sorted = malloc((count > 0 ? count : 1) * sizeof(AtlasRegion*));
+	Rectangle* areas = malloc((count > 0 ? count : 1) * sizeof(Rectangle));
+	AtlasRegion* packed = malloc((count > 0 ? count : 1) * sizeof(AtlasRegion));
+	if (!first || !moved_to || !sorted || !areas || !packed)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		free(first);
+		free(moved_to);
+		free(sorted);
+		free(areas);
+		free(packed);
+		return false;
+	}
+
+	// Counting sort of the regions by page, then by position on the page
+	for (size_t i = 0; i < count; i++)
+		first[regions[i].page + 1]++;
+	for (size_t page = 0; page < page_count; page++)
+		first[page + 1] += first[page];
+	for (size_t i = 0; i < count; i++)
+		sorted[first[regions[i].page]++] = &regions[i];
+	for (size_t page = page_count; page > 0; page--)
+		first[page] = first[page - 1];
+	first[0] = 0;
+
+	// Pages that lost regions are dropped, nothing more is placed on them
+	bool changed = false;
+	for (size_t page = 0; page < page_count; page++)
+	{
+		size_t region_count = first[page + 1] - first[page];
+		qsort(sorted + first[page], region_count, sizeof(AtlasRegion*), compare_region_positions);
+
+		moved_to[page] = 0;
+		if (get_distinct_areas(sorted + first[page], region_count, areas) != atlas->items[page]->region_count)
+		{
+			AtlasPage* dropped = atlas->items[page];
+			dropped->shelf_y = dropped->image.height;
+			moved_to[page] = SIZE_MAX;
+			changed = true;
+		}
+	}
+
+	// Their regions go to the free space of the last page if it stays, then to new pages
+	for (size_t page = 0; page < page_count; page++)
+	{
+		if (moved_to[page] != SIZE_MAX)
+			continue;
+
+		AtlasRegion** page_regions = sorted + first[page];
+		size_t region_count = first[page + 1] - first[page];
+		size_t distinct = get_distinct_areas(page_regions, region_count, areas);
+		if (distinct == 0)
+			continue;
+
+		if (!atlas_add_image_areas(atlas, atlas->items[page]->image, areas, distinct, packed))
+		{
+			// The page stays as it is
+			moved_to[page] = 0;
+			continue;
+		}
+
+		for (size_t i = 0, area = 0; i < region_count; i++)
+		{
+			Rectangle source = page_regions[i]->source;
+			if (source.x != areas[area].x || source.y != areas[area].y)
+				area++;
+
+			*page_regions[i] = packed[area];
+		}
+	}
+
+	if (changed)
+	{
+		size_t kept = 0;
+		for (size_t page = 0; page < atlas->size; page++)
+		{
+			if (page < page_count && moved_to[page] == SIZE_MAX)
+			{
+				unload_page(atlas->items[page]);
+				continue;
+			}
+
+			if (page < page_count)
+				moved_to[page] = kept;
+			atlas->items[kept++] = atlas->items[page];
+		}
+
+		// New pages come after the old ones, they move down by the number of pages dropped
+		size_t dropped = atlas->size - kept;
+		for (size_t i = 0; i < count; i++)
+			regions[i].page = regions[i].page < page_count ? moved_to[regions[i].page] : regions[i].page - dropped;
+
+		atlas->size = kept;
+		atlas->revision++;
+	}
+
+	free(first);
+	free(moved_to);
+	free(sorted);
+	free(areas);
+	free(packed);
+	return changed;
+}
+
+Atlas atlas_share(const Atlas* atlas)
+{
+	Atlas result = {0};
+	if (!atlas || atlas->size == 0)
+		return result;
+
+	result.items = malloc(atlas->size * sizeof(AtlasPage*));
+	if (!result.items)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return result;
+	}
+
+	for (size_t i = 0; i < atlas->size; i++)
+	{
+		atomic_fetch_add(&atlas->items[i]->shares, 1);
+		result.items[i] = atlas->items[i];
+	}
+	result.size = atlas->size;
+	result.capacity = atlas->size;
+	result.revision = atlas->revision;
+
+	return result;
+}
+
+void atlas_release(Atlas* atlas)
+{
+	if (!atlas)
+		return;
+
+	for (size_t i = 0; i < atlas->size; i++)
+		release_page(atlas->items[i]);
+
+	free(atlas->items);
+	*atlas = (Atlas){0};
+}
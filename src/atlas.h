@@ -0,0 +1,71 @@
+#pragma once
+
+#include <raylib.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of a new atlas page, pages are only bigger when a single image doesn't fit
+#define ATLAS_PAGE_SIZE 2048
+// Every image is surrounded by a copy of its edge pixels so neighbours don't bleed in
+#define ATLAS_PADDING 1
+
+typedef struct
+{
+	Image image; // CPU copy of the page, always R8G8B8A8
+	Texture2D texture;
+	bool dirty; // image changed since the last upload
+	int dirty_top; // Rows changed since the last upload, from dirty_top to dirty_bottom excluded
+	int dirty_bottom;
+	// Owners besides the first (shared copies of the atlas), the page is freed by the last one.
+	// Pixels of existing regions never change, so shared copies can read them from any thread.
+	atomic_uint shares;
+	size_t region_count; // Regions ever placed on the page
+
+	// Shelf packing: images are placed left to right on the current shelf
+	int shelf_x;
+	int shelf_y;
+	int shelf_height;
+} AtlasPage;
+
+typedef struct
+{
+	// Pages are allocated one by one so &page->texture stays valid for ImGui
+	AtlasPage** items;
+	size_t size;
+	size_t capacity;
+	uint64_t revision; // Incremented whenever a page is uploaded
+} Atlas;
+
+typedef struct
+{
+	size_t page;
+	Rectangle source; // Area of the page holding the image
+	Color average; // Alpha weighted average of the pixels, for zoomed out views
+} AtlasRegion;
+
+// Copies the image into a page, returns false if it could not be added
+bool atlas_add_image(Atlas* atlas, Image image, AtlasRegion* region);
+// Copies count areas of an R8G8B8A8 image into pages as separate images, regions[i] gets areas[i].
+// The pixels are copied by parallel_for jobs.
+bool atlas_add_image_areas(Atlas* atlas, Image rgba, const Rectangle* areas, size_t count, AtlasRegion* regions);
+// Frees the area of the regions no longer in use: regions are all the regions still in use (the
+// same region may be there several times), they are updated in place. The regions of a page that
+// lost some move to new pages, pages left empty are dropped. Regions on the other pages only get
+// their page index shifted. Returns false if nothing changed.
+bool atlas_repack(Atlas* atlas, AtlasRegion* regions, size_t count);
+// Returns a copy of the pixels of a region, must be unloaded with UnloadImage
+Image atlas_get_image(const Atlas* atlas, AtlasRegion region);
+const Texture2D* atlas_get_texture(const Atlas* atlas, AtlasRegion region);
+
+// Uploads up to max_uploads of the pages that changed since the last call (all of them when 0),
+// returns how many are still waiting. Needs the GPU context. Tiles on a page that was never
+// uploaded (texture.id 0) are not drawn yet.
+size_t atlas_update(Atlas* atlas, size_t max_uploads);
+void atlas_unload(Atlas* atlas);
+
+// Read only copy of the atlas sharing its pages, for reading regions from another thread
+Atlas atlas_share(const Atlas* atlas);
+// Releases the pages of a shared copy, never touches GPU textures so it is safe on any thread
+void atlas_release(Atlas* atlas);
@@ -0,0 +1,434 @@
+// Headless benchmarks of the tilemap code on synthetic maps
+//
+//   tilemap_bench [-o <results.json>] [--max-tiles <count>] [--repeat <count>] [--dir <directory>]
+//
+// Every map is generated from a fixed seed, so runs on the same machine can be compared. Results
+// are written as JSON: one entry per map and benchmark with the minimum and median of the repeats.
+// Save and load go through a file in --dir (the current directory by default).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tilemap.h"
+#include "tile_renderer.h"
+#include "static_index.h"
+#include "parallel.h"
+#include "utils.h"
+
+#define BENCH_RESULT_VERSION 1
+#define BENCH_DEFAULT_REPEAT 3
+#define BENCH_MAX_REPEAT 64
+#define BENCH_TEXTURE_SIZE 16
+// Random operations per repeat of the pick and edit benchmarks
+#define BENCH_OPERATIONS (1 << 20)
+#define BENCH_STATIC_PICKS (1 << 16)
+// Views per repeat of the draw list benchmark, about a 1080p screen at 30 pixels per tile
+#define BENCH_VIEWS 1000
+#define BENCH_VIEW_WIDTH 64.0f
+#define BENCH_VIEW_HEIGHT 36.0f
+// Sparse maps have one tile every BENCH_SPARSE_SPACING cells
+#define BENCH_SPARSE_SPACING 4
+// Static tiles per grid tile on the main layer
+#define BENCH_STATIC_RATIO 0.01
+
+typedef struct
+{
+	const char* name;
+	size_t tile_count; // Grid tiles, over every layer
+	int layer_count; // Main layer included
+	int texture_count;
+	bool sparse;
+} MapSpec;
+
+static const MapSpec maps[] =
+{
+	{ "dense-10k", 10000, 1, 64, false },
+	{ "dense-100k", 100000, 1, 64, false },
+	{ "dense-1m", 1000000, 1, 64, false },
+	{ "dense-1m-4-layers-1024-textures", 1000000, 4, 1024, false },
+	{ "dense-10m", 10000000, 1, 64, false },
+	{ "sparse-10k", 10000, 1, 64, true },
+	{ "sparse-100k", 100000, 1, 64, true },
+	{ "sparse-1m", 1000000, 1, 64, true },
+};
+
+typedef struct
+{
+	FILE* out;
+	bool first;
+	int repeat;
+	const char* filepath; // Used by the save and load benchmarks
+} Bench;
+
+typedef struct
+{
+	Tilemap tilemap;
+	int side; // Cells are in [0, side) on both axes
+} BenchMap;
+
+static double get_seconds(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// xorshift64*, deterministic across platforms
+static uint64_t next_random(uint64_t* state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static int random_below(uint64_t* state, int limit)
+{
+	return (int)(next_random(state) % (uint64_t)limit);
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void report(Bench* bench, const MapSpec* map, const char* benchmark, size_t operations, double* times, int count)
+{
+	qsort(times, count, sizeof(double), compare_doubles);
+	double median = count % 2 ? times[count / 2] : (times[count / 2 - 1] + times[count / 2]) * 0.5;
+
+	fprintf(bench->out, "%s\n    {\"map\": \"%s\", \"tiles\": %zu, \"layers\": %d, \"textures\": %d, \"sparse\": %s, "
+		"\"benchmark\": \"%s\", \"operations\": %zu, \"repeat\": %d, \"min_seconds\": %.9f, \"median_seconds\": %.9f, "
+		"\"ns_per_operation\": %.3f}",
+		bench->first ? "" : ",", map->name, map->tile_count, map->layer_count, map->texture_count,
+		map->sparse ? "true" : "false", benchmark, operations, count, times[0], median, times[0] * 1e9 / operations);
+	bench->first = false;
+
+	fprintf(stderr, "%-34s %-12s %12.3f ms %10.1f ns/op\n", map->name, benchmark, times[0] * 1e3, times[0] * 1e9 / operations);
+}
+
+static Layer* get_bench_layer(Tilemap* tilemap, int index)
+{
+	return index == 0 ? &tilemap->main_layer : &tilemap->layers.items[index - 1];
+}
+
+static bool generate_map(const MapSpec* spec, BenchMap* result)
+{
+	*result = (BenchMap){0};
+	Tilemap* tilemap = &result->tilemap;
+
+	for (int i = 0; i < spec->texture_count; i++)
+	{
+		Color color = { (unsigned char)(i * 37), (unsigned char)(i * 91), (unsigned char)(i * 13 + i / 256), 255 };
+		Image image = GenImageColor(BENCH_TEXTURE_SIZE, BENCH_TEXTURE_SIZE, color);
+		// Distinct pixels, so identical images don't collapse when saving
+		((unsigned char*)image.data)[0] = (unsigned char)i;
+		((unsigned char*)image.data)[1] = (unsigned char)(i >> 8);
+		bool added = add_texture(tilemap, image);
+		UnloadImage(image);
+		if (!added)
+			return false;
+	}
+
+	for (int i = 1; i < spec->layer_count; i++)
+	{
+		Layer layer = {0};
+		da_append(tilemap->layers, layer);
+	}
+
+	size_t per_layer = spec->tile_count / spec->layer_count;
+	int spacing = spec->sparse ? BENCH_SPARSE_SPACING : 1;
+	result->side = (int)ceil(sqrt((double)per_layer)) * spacing;
+
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	for (int i = 0; i < spec->layer_count; i++)
+	{
+		Layer* layer = get_bench_layer(tilemap, i);
+		int chunk_side = CHUNK_SIZE / spacing;
+		tile_grid_reserve(&layer->tiles, per_layer / (chunk_side * chunk_side) + 1);
+
+		// Dense maps fill a square row by row, sparse ones spread their tiles on a grid of spacing cells
+		for (size_t j = 0; j < per_layer; j++)
+		{
+			int columns = result->side / spacing;
+			Tile tile =
+			{
+				.tilemap_index = { (int)(j % columns) * spacing, (int)(j / columns) * spacing },
+				.texture_index = (size_t)random_below(&state, spec->texture_count),
+				.tint = WHITE,
+			};
+			tile_grid_set(&layer->tiles, tile);
+		}
+	}
+
+	size_t static_count = (size_t)(spec->tile_count * BENCH_STATIC_RATIO);
+	for (size_t i = 0; i < static_count; i++)
+	{
+		Tile tile =
+		{
+			.bounds = { random_below(&state, result->side) + 0.25f, random_below(&state, result->side) + 0.25f, 1.5f, 1.5f },
+			.texture_index = (size_t)random_below(&state, spec->texture_count),
+			.tint = WHITE,
+		};
+		da_append(tilemap->main_layer.static_tiles, tile);
+	}
+	rebuild_static_index(&tilemap->main_layer);
+
+	return true;
+}
+
+static void bench_save_load(Bench* bench, const MapSpec* spec, BenchMap* map)
+{
+	double times[BENCH_MAX_REPEAT];
+	for (int i = 0; i < bench->repeat; i++)
+	{
+		double start = get_seconds();
+		if (!save_tilemap(&map->tilemap, bench->filepath))
+			fprintf(stderr, "ERROR: Could not save %s\n", bench->filepath);
+		times[i] = get_seconds() - start;
+	}
+	report(bench, spec, "save", spec->tile_count, times, bench->repeat);
+
+	for (int i = 0; i < bench->repeat; i++)
+	{
+		double start = get_seconds();
+		Tilemap loaded = load_tilemap(bench->filepath);
+		times[i] = get_seconds() - start;
+		unload_tilemap(&loaded);
+	}
+	report(bench, spec, "load", spec->tile_count, times, bench->repeat);
+
+	unlink(bench->filepath);
+}
+
+static void bench_pick(Bench* bench, const MapSpec* spec, BenchMap* map)
+{
+	double times[BENCH_MAX_REPEAT];
+	size_t found = 0;
+	for (int i = 0; i < bench->repeat; i++)
+	{
+		uint64_t state = 1 + i;
+		double start = get_seconds();
+		// Like the editor: the topmost layer with a tile under the cursor wins
+		for (size_t j = 0; j < BENCH_OPERATIONS; j++)
+		{
+			Vec2i index = { random_below(&state, map->side), random_below(&state, map->side) };
+			for (int k = spec->layer_count - 1; k >= 0; k--)
+			{
+				if (tile_grid_get(&get_bench_layer(&map->tilemap, k)->tiles, index, NULL))
+				{
+					found++;
+					break;
+				}
+			}
+		}
+		times[i] = get_seconds() - start;
+	}
+	report(bench, spec, "pick", BENCH_OPERATIONS, times, bench->repeat);
+
+	for (int i = 0; i < bench->repeat; i++)
+	{
+		uint64_t state = 1 + i;
+		double start = get_seconds();
+		for (size_t j = 0; j < BENCH_STATIC_PICKS; j++)
+		{
+			Vector2 point = { random_below(&state, map->side) + 0.5f, random_below(&state, map->side) + 0.5f };
+			found += pick_static_tile(&map->tilemap.main_layer, point) >= 0;
+		}
+		times[i] = get_seconds() - start;
+	}
+	report(bench, spec, "pick_static", BENCH_STATIC_PICKS, times, bench->repeat);
+
+	// Keeps the loops from being optimized away
+	if (found == SIZE_MAX)
+		fprintf(stderr, "%zu\n", found);
+}
+
+// Chunk culling, quad geometry and static tile queries for views spread over the map,
+// the CPU side of draw_tilemap
+static void bench_draw_list(Bench* bench, const MapSpec* spec, BenchMap* map)
+{
+	ChunkGeometry* geometry = malloc(sizeof(ChunkGeometry));
+	if (!geometry)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return;
+	}
+	*geometry = (ChunkGeometry){0};
+
+	VisibleChunks chunks = {0};
+	Indices statics = {0};
+	size_t quads = 0;
+
+	double times[BENCH_MAX_REPEAT];
+	for (int i = 0; i < bench->repeat; i++)
+	{
+		uint64_t state = 1 + i;
+		double start = get_seconds();
+		for (size_t j = 0; j < BENCH_VIEWS; j++)
+		{
+			Rectangle view =
+			{
+				.x = (float)random_below(&state, map->side),
+				.y = (float)random_below(&state, map->side),
+				.width = BENCH_VIEW_WIDTH,
+				.height = BENCH_VIEW_HEIGHT,
+			};
+
+			for (int k = 0; k < spec->layer_count; k++)
+			{
+				const Layer* layer = get_bench_layer(&map->tilemap, k);
+				chunks.size = 0;
+				get_visible_chunks(&layer->tiles, view, &chunks);
+				for (size_t c = 0; c < chunks.size; c++)
+				{
+					build_chunk_geometry(&map->tilemap, chunks.items[c], geometry);
+					quads += geometry->quad_count;
+				}
+
+				statics.size = 0;
+				query_static_tiles(layer, view, &statics);
+				quads += statics.size;
+			}
+		}
+		times[i] = get_seconds() - start;
+	}
+	report(bench, spec, "draw_list", BENCH_VIEWS, times, bench->repeat);
+
+	if (quads == SIZE_MAX)
+		fprintf(stderr, "%zu\n", quads);
+
+	free(geometry->ranges.items);
+	free(geometry);
+	free(chunks.items);
+	free(statics.items);
+}
+
+// Changes the map, runs last
+static void bench_edit(Bench* bench, const MapSpec* spec, BenchMap* map)
+{
+	TileGrid* grid = &map->tilemap.main_layer.tiles;
+	double insert_times[BENCH_MAX_REPEAT];
+	double erase_times[BENCH_MAX_REPEAT];
+	for (int i = 0; i < bench->repeat; i++)
+	{
+		uint64_t state = 1 + i;
+		double start = get_seconds();
+		for (size_t j = 0; j < BENCH_OPERATIONS; j++)
+		{
+			Tile tile =
+			{
+				.tilemap_index = { random_below(&state, map->side), random_below(&state, map->side) },
+				.texture_index = (size_t)random_below(&state, spec->texture_count),
+				.tint = WHITE,
+			};
+			tile_grid_set(grid, tile);
+		}
+		insert_times[i] = get_seconds() - start;
+
+		state = 1 + i;
+		start = get_seconds();
+		for (size_t j = 0; j < BENCH_OPERATIONS; j++)
+		{
+			Vec2i index = { random_below(&state, map->side), random_below(&state, map->side) };
+			random_below(&state, spec->texture_count);
+			tile_grid_erase(grid, index);
+		}
+		erase_times[i] = get_seconds() - start;
+	}
+	report(bench, spec, "insert", BENCH_OPERATIONS, insert_times, bench->repeat);
+	report(bench, spec, "erase", BENCH_OPERATIONS, erase_times, bench->repeat);
+}
+
+static void print_usage(const char* program)
+{
+	fprintf(stderr, "Usage: %s [-o <results.json>] [--max-tiles <count>] [--repeat <count>] [--dir <directory>]\n", program);
+}
+
+int main(int argc, char** argv)
+{
+	const char* output_path = NULL;
+	const char* directory = ".";
+	size_t max_tiles = SIZE_MAX;
+	Bench bench = { .out = stdout, .first = true, .repeat = BENCH_DEFAULT_REPEAT };
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "-o") == 0 && has_value)
+			output_path = argv[++i];
+		else if (strcmp(argv[i], "--max-tiles") == 0 && has_value)
+			max_tiles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--repeat") == 0 && has_value)
+			bench.repeat = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--dir") == 0 && has_value)
+			directory = argv[++i];
+		else
+		{
+			print_usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (bench.repeat < 1 || bench.repeat > BENCH_MAX_REPEAT)
+	{
+		fprintf(stderr, "ERROR: --repeat must be between 1 and %d\n", BENCH_MAX_REPEAT);
+		return 2;
+	}
+
+	if (output_path)
+	{
+		bench.out = fopen(output_path, "w");
+		if (!bench.out)
+		{
+			fprintf(stderr, "ERROR: Could not open %s\n", output_path);
+			return 1;
+		}
+	}
+
+	char filepath[4096];
+	snprintf(filepath, sizeof(filepath), "%s/tilemap_bench_%ld.miau", directory, (long)getpid());
+	bench.filepath = filepath;
+
+	fprintf(bench.out, "{\n  \"version\": %d,\n  \"threads\": %d,\n  \"repeat\": %d,\n  \"results\": [",
+		BENCH_RESULT_VERSION, get_thread_count(), bench.repeat);
+
+	for (size_t i = 0; i < sizeof(maps) / sizeof(maps[0]); i++)
+	{
+		const MapSpec* spec = &maps[i];
+		if (spec->tile_count > max_tiles)
+			continue;
+
+		BenchMap map;
+		double start = get_seconds();
+		if (!generate_map(spec, &map))
+		{
+			fprintf(stderr, "ERROR: Could not generate %s\n", spec->name);
+			unload_tilemap(&map.tilemap);
+			continue;
+		}
+		double generate_time = get_seconds() - start;
+		report(&bench, spec, "generate", spec->tile_count, &generate_time, 1);
+
+		bench_save_load(&bench, spec, &map);
+		bench_pick(&bench, spec, &map);
+		bench_draw_list(&bench, spec, &map);
+		bench_edit(&bench, spec, &map);
+
+		unload_tilemap(&map.tilemap);
+	}
+
+	fprintf(bench.out, "\n  ]\n}\n");
+	if (bench.out != stdout)
+		fclose(bench.out);
+
+	return 0;
+}
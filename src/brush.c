@@ -0,0 +1,158 @@
+#include "brush.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils.h"
+
+// Columns covered by each row of the brush, relative to its center: row y (from *low to *high)
+// covers first[y - *low] to last[y - *low], rows are never empty
+static void get_brush_rows(Brush brush, int* low, int* high, int* first, int* last)
+{
+	int size = brush.size < 1 ? 1 : brush.size > BRUSH_MAX_SIZE ? BRUSH_MAX_SIZE : brush.size;
+	*low = -(size - 1) / 2;
+	*high = size / 2;
+
+	// Even brushes are centered between cells
+	float middle = (*low + *high) * 0.5f;
+	float radius = size * 0.5f;
+	float limit = radius * radius - radius * 0.5f;
+
+	for (int y = *low; y <= *high; y++)
+	{
+		int row = y - *low;
+		first[row] = *low;
+		last[row] = *high;
+		if (brush.shape != BRUSH_CIRCLE)
+			continue;
+
+		// Circles are symmetric, narrow the row from both sides
+		float dy = y - middle;
+		while (first[row] < last[row] && (first[row] - middle) * (first[row] - middle) + dy * dy > limit)
+		{
+			first[row]++;
+			last[row]--;
+		}
+	}
+}
+
+static void append_span(CellList* cells, int y, int first, int last)
+{
+	for (int x = first; x <= last; x++)
+		da_append(*cells, ((Vec2i){ x, y }));
+}
+
+void brush_stamp(Brush brush, Vec2i center, CellList* cells)
+{
+	int low, high;
+	int first[BRUSH_MAX_SIZE];
+	int last[BRUSH_MAX_SIZE];
+	get_brush_rows(brush, &low, &high, first, last);
+
+	for (int y = low; y <= high; y++)
+		append_span(cells, center.y + y, center.x + first[y - low], center.x + last[y - low]);
+}
+
+void brush_line(Brush brush, Vec2i from, Vec2i to, CellList* cells)
+{
+	int low, high;
+	int first[BRUSH_MAX_SIZE];
+	int last[BRUSH_MAX_SIZE];
+	get_brush_rows(brush, &low, &high, first, last);
+
+	// The brush moves at most one cell per step and its rows overlap their neighbours,
+	// so every row of the line is a single span: track its ends instead of stamping cells
+	int top = (from.y < to.y ? from.y : to.y) + low;
+	int row_count = abs(to.y - from.y) + high - low + 1;
+	int* span_first = malloc(row_count * sizeof(int));
+	int* span_last = malloc(row_count * sizeof(int));
+	if (!span_first || !span_last)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		free(span_first);
+		free(span_last);
+		return;
+	}
+	for (int i = 0; i < row_count; i++)
+	{
+		span_first[i] = INT_MAX;
+		span_last[i] = INT_MIN;
+	}
+
+	// Bresenham, widening the rows under the brush on every cell of the line
+	int dx = abs(to.x - from.x);
+	int dy = -abs(to.y - from.y);
+	int step_x = from.x < to.x ? 1 : -1;
+	int step_y = from.y < to.y ? 1 : -1;
+	int error = dx + dy;
+
+	Vec2i cell = from;
+	while (true)
+	{
+		for (int y = low; y <= high; y++)
+		{
+			int row = cell.y + y - top;
+			if (cell.x + first[y - low] < span_first[row])
+				span_first[row] = cell.x + first[y - low];
+			if (cell.x + last[y - low] > span_last[row])
+				span_last[row] = cell.x + last[y - low];
+		}
+
+		if (vec2i_equals(cell, to))
+			break;
+
+		int error2 = 2 * error;
+		if (error2 >= dy)
+		{
+			error += dy;
+			cell.x += step_x;
+		}
+		if (error2 <= dx)
+		{
+			error += dx;
+			cell.y += step_y;
+		}
+	}
+
+	for (int i = 0; i < row_count; i++)
+		append_span(cells, top + i, span_first[i], span_last[i]);
+
+	free(span_first);
+	free(span_last);
+}
+
+static int compare_cells(const void* a, const void* b)
+{
+	Vec2i cell_a = *(const Vec2i*)a;
+	Vec2i cell_b = *(const Vec2i*)b;
+	Vec2i chunk_a = get_chunk_position(cell_a);
+	Vec2i chunk_b = get_chunk_position(cell_b);
+
+	if (chunk_a.y != chunk_b.y)
+		return chunk_a.y < chunk_b.y ? -1 : 1;
+	if (chunk_a.x != chunk_b.x)
+		return chunk_a.x < chunk_b.x ? -1 : 1;
+	if (cell_a.y != cell_b.y)
+		return cell_a.y < cell_b.y ? -1 : 1;
+	if (cell_a.x != cell_b.x)
+		return cell_a.x < cell_b.x ? -1 : 1;
+
+	return 0;
+}
+
+void sort_cells(CellList* cells)
+{
+	if (cells->size < 2)
+		return;
+
+	qsort(cells->items, cells->size, sizeof(Vec2i), compare_cells);
+
+	size_t kept = 1;
+	for (size_t i = 1; i < cells->size; i++)
+	{
+		if (!vec2i_equals(cells->items[i], cells->items[kept - 1]))
+			cells->items[kept++] = cells->items[i];
+	}
+	cells->size = kept;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "tilemap.h"
+
+#define BRUSH_MAX_SIZE 64
+
+typedef enum
+{
+	BRUSH_SQUARE,
+	BRUSH_CIRCLE,
+} BrushShape;
+
+typedef struct
+{
+	BrushShape shape;
+	int size; // Width in cells
+} Brush;
+
+typedef struct
+{
+	Vec2i* items;
+	size_t size;
+	size_t capacity;
+} CellList;
+
+// Appends the cells covered by the brush centered on the given cell
+void brush_stamp(Brush brush, Vec2i center, CellList* cells);
+// Appends the cells covered by the brush moved from one cell to the other, both included, each once
+void brush_line(Brush brush, Vec2i from, Vec2i to, CellList* cells);
+
+// Sorts the cells chunk by chunk, rows in order inside a chunk, and removes duplicates,
+// so applying them visits every chunk once
+void sort_cells(CellList* cells);
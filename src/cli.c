@@ -0,0 +1,368 @@
+// Headless tool processing tilemap files in batches, it never opens a window or touches the GPU
+//
+//   tilemap_cli <command> [-o <directory>] <files...>
+//
+// Files are processed in parallel, the report of each one is printed in the order given.
+// Commands writing files replace them (through a temporary file), or write to the directory given
+// with -o under the same name; two files that would be written to the same path are an error.
+// The exit status is 0 when every file succeeded, 1 otherwise.
+// A trace of the run is written to the file named by the TILEMAP_TRACE environment variable.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tilemap.h"
+#include "tilemap_file.h"
+#include "parallel.h"
+#include "trace.h"
+
+typedef enum
+{
+	COMMAND_INFO,
+	COMMAND_VALIDATE,
+	COMMAND_CONVERT,
+	COMMAND_MERGE_LAYERS,
+	COMMAND_STRIP_UNUSED_TEXTURES,
+	COMMAND_COUNT,
+} Command;
+
+typedef struct
+{
+	const char* name;
+	const char* description;
+	bool writes;
+} CommandInfo;
+
+static const CommandInfo commands[COMMAND_COUNT] =
+{
+	[COMMAND_INFO] = { "info", "Print the layers, tiles and textures of the files", false },
+	[COMMAND_VALIDATE] = { "validate", "Check that the files load and every tile uses an existing texture", false },
+	[COMMAND_CONVERT] = { "convert", "Rewrite the files in the current format (version 1 files included)", true },
+	[COMMAND_MERGE_LAYERS] = { "merge-layers", "Merge the layers into the main layer", true },
+	[COMMAND_STRIP_UNUSED_TEXTURES] = { "strip-unused-textures", "Remove the textures no tile uses", true },
+};
+
+typedef struct
+{
+	const char* filepath;
+	bool success;
+	// Report of the file, printed once every file is done so the reports don't interleave
+	char* report;
+	size_t report_size;
+} FileJob;
+
+typedef struct
+{
+	Command command;
+	const char* output_directory; // NULL writes over the input files
+	FileJob* files;
+} Batch;
+
+static void print_usage(const char* program)
+{
+	fprintf(stderr, "Usage: %s <command> [-o <directory>] <files...>\n\nCommands:\n", program);
+	for (int i = 0; i < COMMAND_COUNT; i++)
+		fprintf(stderr, "  %-22s %s\n", commands[i].name, commands[i].description);
+}
+
+static void print_info(FILE* out, const Tilemap* tilemap, uint32_t version)
+{
+	fprintf(out, "  format version %u\n", version);
+	fprintf(out, "  offset %g %g\n", tilemap->offset.x, tilemap->offset.y);
+	fprintf(out, "  textures %zu in %zu atlas pages\n", tilemap->textures.size, tilemap->atlas.size);
+	for (size_t i = 0; i < tilemap->tilesets.size; i++)
+	{
+		const Tileset* tileset = &tilemap->tilesets.items[i];
+		fprintf(out, "    tileset \"%s\": textures %zu to %zu\n", tileset->name,
+			tileset->first_texture, tileset->first_texture + tileset->texture_count - 1);
+	}
+
+	for (size_t i = 0; i < tilemap->layers.size + 1; i++)
+	{
+		const Layer* layer = i == 0 ? &tilemap->main_layer : &tilemap->layers.items[i - 1];
+		fprintf(out, "  layer %zu%s: offset %g %g, %zu grid tiles in %zu chunks, %zu static tiles\n",
+			i, i == 0 ? " (main)" : "", layer->offset.x, layer->offset.y,
+			layer->tiles.tile_count, layer->tiles.size, layer->static_tiles.size);
+	}
+}
+
+// Returns the number of problems found
+static size_t validate_tilemap(FILE* out, const Tilemap* tilemap, const TilemapFileInfo* info)
+{
+	// The loader leaves these out, they are only known from the count
+	size_t problems = info->dropped_static_tiles;
+	if (info->dropped_static_tiles > 0)
+		fprintf(out, "  %zu static tiles use a texture that doesn't exist\n", info->dropped_static_tiles);
+
+	for (size_t i = 0; i < tilemap->layers.size + 1; i++)
+	{
+		const Layer* layer = i == 0 ? &tilemap->main_layer : &tilemap->layers.items[i - 1];
+
+		size_t bad_tiles = 0;
+		size_t tile_count = 0;
+		for (size_t slot = 0; slot < layer->tiles.capacity; slot++)
+		{
+			const Chunk* chunk = layer->tiles.items[slot];
+			if (!chunk)
+				continue;
+
+			size_t chunk_tiles = 0;
+			for (int y = 0; y < CHUNK_SIZE; y++)
+			{
+				for (uint32_t bits = chunk->occupied[y]; bits; bits &= bits - 1)
+				{
+					chunk_tiles++;
+					if (chunk->textures[y * CHUNK_SIZE + __builtin_ctz(bits)] >= tilemap->textures.size)
+						bad_tiles++;
+				}
+			}
+
+			if (chunk_tiles != chunk->tile_count)
+			{
+				fprintf(out, "  layer %zu: chunk %d %d counts %zu tiles but holds %zu\n",
+					i, chunk->position.x, chunk->position.y, chunk->tile_count, chunk_tiles);
+				problems++;
+			}
+			tile_count += chunk_tiles;
+		}
+
+		if (tile_count != layer->tiles.tile_count)
+		{
+			fprintf(out, "  layer %zu: counts %zu grid tiles but holds %zu\n", i, layer->tiles.tile_count, tile_count);
+			problems++;
+		}
+		if (bad_tiles > 0)
+		{
+			fprintf(out, "  layer %zu: %zu tiles use a texture that doesn't exist\n", i, bad_tiles);
+			problems += bad_tiles;
+		}
+	}
+
+	return problems;
+}
+
+// Where the result of processing filepath is written, must be freed
+static char* get_output_path(const Batch* batch, const char* filepath)
+{
+	if (!batch->output_directory)
+		return strdup(filepath);
+
+	const char* slash = strrchr(filepath, '/');
+	const char* name = slash ? slash + 1 : filepath;
+	size_t length = strlen(batch->output_directory) + strlen(name) + 2;
+	char* result = malloc(length);
+	if (result)
+		snprintf(result, length, "%s/%s", batch->output_directory, name);
+
+	return result;
+}
+
+// Files processed in parallel must not write the same output (or its temporary file and journal),
+// returns false after printing the first two that would
+static bool check_output_paths(const Batch* batch, size_t file_count)
+{
+	char** paths = calloc(file_count, sizeof(char*));
+	bool result = paths != NULL;
+	for (size_t i = 0; result && i < file_count; i++)
+	{
+		// Written over, the same file can be named in different ways
+		if (!batch->output_directory)
+			paths[i] = realpath(batch->files[i].filepath, NULL);
+		if (!paths[i])
+			paths[i] = get_output_path(batch, batch->files[i].filepath);
+		result = paths[i] != NULL;
+	}
+	if (!result)
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+
+	for (size_t i = 0; result && i < file_count; i++)
+	{
+		for (size_t j = 0; result && j < i; j++)
+		{
+			if (strcmp(paths[i], paths[j]) != 0)
+				continue;
+
+			fprintf(stderr, "ERROR: %s and %s would both be written to %s\n", batch->files[j].filepath, batch->files[i].filepath, paths[i]);
+			result = false;
+		}
+	}
+
+	for (size_t i = 0; paths && i < file_count; i++)
+		free(paths[i]);
+	free(paths);
+
+	return result;
+}
+
+static bool write_result(FILE* out, const Batch* batch, const Tilemap* tilemap, const char* filepath)
+{
+	char* output_path = get_output_path(batch, filepath);
+	if (!output_path)
+	{
+		fprintf(out, "  could not allocate enough space\n");
+		return false;
+	}
+
+	// A journal left next to the output would be replayed over the new content
+	bool result = save_tilemap(tilemap, output_path) && discard_journal(output_path);
+	fprintf(out, result ? "  written to %s\n" : "  could not write %s\n", output_path);
+
+	free(output_path);
+	return result;
+}
+
+static void process_file(void* context, size_t index)
+{
+	const Batch* batch = context;
+	FileJob* job = &batch->files[index];
+
+	FILE* out = open_memstream(&job->report, &job->report_size);
+	if (!out)
+		return;
+
+	fprintf(out, "%s\n", job->filepath);
+
+	Tilemap tilemap;
+	TilemapFileInfo info;
+	if (!load_tilemap_file(job->filepath, &tilemap, &info))
+	{
+		fprintf(out, "  could not be loaded\n");
+		fclose(out);
+		return;
+	}
+
+	bool success = true;
+	switch (batch->command)
+	{
+	case COMMAND_INFO:
+		print_info(out, &tilemap, info.version);
+		break;
+	case COMMAND_VALIDATE:
+	{
+		size_t problems = validate_tilemap(out, &tilemap, &info);
+		fprintf(out, problems == 0 ? "  ok\n" : "  %zu problems\n", problems);
+		success = problems == 0;
+		break;
+	}
+	case COMMAND_CONVERT:
+		fprintf(out, "  version %u to %u\n", info.version, TILEMAP_FILE_VERSION);
+		success = write_result(out, batch, &tilemap, job->filepath);
+		break;
+	case COMMAND_MERGE_LAYERS:
+	{
+		size_t layer_count = tilemap.layers.size;
+		size_t merged = merge_layers(&tilemap);
+		fprintf(out, "  merged %zu of %zu layers\n", merged, layer_count);
+		if (merged < layer_count)
+		{
+			size_t stopped = layer_count - merged;
+			const Layer* layer = &tilemap.layers.items[stopped - 1];
+			fprintf(out, "  layer %zu %s, it and the layers under it stay\n", stopped,
+				layer->static_tiles.size > 0 ? "has static tiles" : "is not aligned on the grid of the main layer");
+		}
+		success = write_result(out, batch, &tilemap, job->filepath);
+		break;
+	}
+	case COMMAND_STRIP_UNUSED_TEXTURES:
+	{
+		size_t texture_count = tilemap.textures.size;
+		size_t removed = remove_unused_textures(&tilemap);
+		fprintf(out, "  removed %zu of %zu textures\n", removed, texture_count);
+		success = write_result(out, batch, &tilemap, job->filepath);
+		break;
+	}
+	default:
+		break;
+	}
+
+	unload_tilemap(&tilemap);
+	fclose(out);
+	job->success = success;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	Batch batch = { .command = COMMAND_COUNT };
+	for (int i = 0; i < COMMAND_COUNT; i++)
+	{
+		if (strcmp(argv[1], commands[i].name) == 0)
+			batch.command = i;
+	}
+	if (batch.command == COMMAND_COUNT)
+	{
+		fprintf(stderr, "ERROR: Unknown command \"%s\"\n", argv[1]);
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	batch.files = calloc((size_t)argc, sizeof(FileJob));
+	if (!batch.files)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return 1;
+	}
+
+	size_t file_count = 0;
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-o") != 0)
+		{
+			batch.files[file_count++].filepath = argv[i];
+			continue;
+		}
+
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "ERROR: -o needs a directory\n");
+			free(batch.files);
+			return 2;
+		}
+		if (!commands[batch.command].writes)
+			fprintf(stderr, "WARNING: %s writes no files, -o is ignored\n", commands[batch.command].name);
+		batch.output_directory = argv[++i];
+	}
+
+	if (file_count == 0)
+	{
+		print_usage(argv[0]);
+		free(batch.files);
+		return 2;
+	}
+
+	if (commands[batch.command].writes && !check_output_paths(&batch, file_count))
+	{
+		free(batch.files);
+		return 2;
+	}
+
+	trace_init(getenv(TRACE_ENV));
+	parallel_for(file_count, process_file, &batch);
+	if (trace_enabled)
+		trace_write();
+
+	size_t failed = 0;
+	for (size_t i = 0; i < file_count; i++)
+	{
+		FileJob* job = &batch.files[i];
+		if (job->report)
+			fwrite(job->report, 1, job->report_size, stdout);
+		if (!job->success)
+			failed++;
+		free(job->report);
+	}
+
+	if (file_count > 1)
+		printf("%zu of %zu files succeeded\n", file_count - failed, file_count);
+
+	free(batch.files);
+	return failed == 0 ? 0 : 1;
+}
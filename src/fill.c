@@ -0,0 +1,207 @@
+#include "fill.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+typedef struct
+{
+	Vec2i* items;
+	size_t size;
+	size_t capacity;
+} Seeds;
+
+// Reads cells, looking the chunk up only when it isn't the one of the previous cell
+typedef struct
+{
+	const TileGrid* grid;
+	const Chunk* chunk;
+	Vec2i position;
+	bool valid; // Cleared when the grid changes
+} CellReader;
+
+static CellValue read_cell(CellReader* reader, Vec2i index)
+{
+	Vec2i position = get_chunk_position(index);
+	if (!reader->valid || !vec2i_equals(position, reader->position))
+	{
+		reader->chunk = tile_grid_get_chunk(reader->grid, position);
+		reader->position = position;
+		reader->valid = true;
+	}
+
+	if (!reader->chunk)
+		return get_cell_value(NULL);
+
+	int x = index.x - position.x * CHUNK_SIZE;
+	int y = index.y - position.y * CHUNK_SIZE;
+	if (!chunk_has_tile(reader->chunk, x, y))
+		return get_cell_value(NULL);
+
+	Tile tile = chunk_get_tile(reader->chunk, x, y);
+	return get_cell_value(&tile);
+}
+
+static bool cell_matches(CellReader* reader, int x, int y, CellValue value)
+{
+	return cell_value_equals(read_cell(reader, (Vec2i){ x, y }), value);
+}
+
+// Appends the cells of a row just written over written.before as the grid stored them, one delta
+// per run of the same content. Returns false if some of them still hold written.before.
+static bool append_written_row(CellReader* reader, CellDelta written, CellDeltas* changes)
+{
+	bool changed = true;
+	int end_x = written.index.x + (int)written.length;
+	int x = written.index.x;
+	while (x < end_x)
+	{
+		CellValue after = read_cell(reader, (Vec2i){ x, written.index.y });
+		int end = x + 1;
+		while (end < end_x && cell_matches(reader, end, written.index.y, after))
+			end++;
+
+		if (cell_value_equals(after, written.before))
+			changed = false;
+		else
+		{
+			CellDelta delta = written;
+			delta.index.x = x;
+			delta.length = (uint32_t)(end - x);
+			delta.after = after;
+			da_append(*changes, delta);
+		}
+
+		x = end;
+	}
+
+	return changed;
+}
+
+FillResult flood_fill(TileGrid* grid, uint32_t layer, Vec2i start, const Tile* tile, size_t max_cells, CellDeltas* changes)
+{
+	CellValue value = get_cell_value(tile);
+	CellReader reader = { .grid = grid };
+	CellValue seed = read_cell(&reader, start);
+	if (cell_value_equals(seed, value))
+		return FILL_UNCHANGED;
+
+	size_t first_change = changes->size;
+	size_t cell_count = 0;
+	FillResult result = FILL_DONE;
+
+	// Scanline fill: every popped seed fills its whole row span, then seeds the runs of matching
+	// cells above and below it. Filled cells no longer match, so nothing is visited twice.
+	Seeds seeds = {0};
+	da_append(seeds, start);
+	while (seeds.size > 0)
+	{
+		Vec2i cell = seeds.items[--seeds.size];
+		if (!cell_matches(&reader, cell.x, cell.y, seed))
+			continue;
+
+		// Stops one cell past the limit, so a region that is too big is noticed
+		int left = cell.x;
+		int right = cell.x;
+		while (cell_count + (size_t)(right - left + 1) <= max_cells && cell_matches(&reader, left - 1, cell.y, seed))
+			left--;
+		while (cell_count + (size_t)(right - left + 1) <= max_cells && cell_matches(&reader, right + 1, cell.y, seed))
+			right++;
+
+		size_t length = (size_t)(right - left + 1);
+		if (cell_count + length > max_cells)
+		{
+			result = FILL_TOO_BIG;
+			break;
+		}
+		cell_count += length;
+
+		Vec2i row = { left, cell.y };
+		tile_grid_fill_row(grid, row, (int)length, tile);
+		reader.valid = false;
+
+		CellDelta written = { .index = row, .layer = layer, .length = (uint32_t)length, .before = seed, .after = value };
+		if (!append_written_row(&reader, written, changes))
+		{
+			result = FILL_TOO_MANY_TINTS;
+			break;
+		}
+
+		for (int y = cell.y - 1; y <= cell.y + 1; y += 2)
+		{
+			bool in_run = false;
+			for (int x = left; x <= right; x++)
+			{
+				bool matches = cell_matches(&reader, x, y, seed);
+				if (matches && !in_run)
+					da_append(seeds, ((Vec2i){ x, y }));
+				in_run = matches;
+			}
+		}
+	}
+	free(seeds.items);
+
+	if (result != FILL_DONE)
+	{
+		// Put the rows filled so far back
+		Tile seed_tile = { .texture_index = seed.texture_index, .tint = seed.tint };
+		const Tile* previous = seed.texture_index == HISTORY_EMPTY ? NULL : &seed_tile;
+		for (size_t i = first_change; i < changes->size; i++)
+			tile_grid_fill_row(grid, changes->items[i].index, (int)changes->items[i].length, previous);
+		changes->size = first_change;
+	}
+
+	return result;
+}
+
+FillResult fill_rectangle(TileGrid* grid, uint32_t layer, Vec2i a, Vec2i b, const Tile* tile, size_t max_cells, CellDeltas* changes)
+{
+	int min_x = a.x < b.x ? a.x : b.x;
+	int max_x = a.x < b.x ? b.x : a.x;
+	int min_y = a.y < b.y ? a.y : b.y;
+	int max_y = a.y < b.y ? b.y : a.y;
+
+	size_t width = (size_t)((int64_t)max_x - min_x + 1);
+	size_t height = (size_t)((int64_t)max_y - min_y + 1);
+	if (width > max_cells / height)
+		return FILL_TOO_BIG;
+
+	CellValue value = get_cell_value(tile);
+	CellReader reader = { .grid = grid };
+	size_t first_change = changes->size;
+
+	// One delta per run of cells that had the same content, runs already holding value are skipped
+	for (int y = min_y; y <= max_y; y++)
+	{
+		int x = min_x;
+		while (x <= max_x)
+		{
+			CellValue before = read_cell(&reader, (Vec2i){ x, y });
+			int end = x + 1;
+			while (end <= max_x && cell_matches(&reader, end, y, before))
+				end++;
+
+			if (!cell_value_equals(before, value))
+			{
+				CellDelta delta = { .index = { x, y }, .layer = layer, .length = (uint32_t)(end - x), .before = before, .after = value };
+				da_append(*changes, delta);
+			}
+
+			x = end;
+		}
+	}
+
+	size_t written_end = changes->size;
+	for (size_t i = first_change; i < written_end; i++)
+		tile_grid_fill_row(grid, changes->items[i].index, (int)changes->items[i].length, tile);
+
+	// The rows as written are replaced by what the grid stored
+	reader.valid = false;
+	for (size_t i = first_change; i < written_end; i++)
+		append_written_row(&reader, changes->items[i], changes);
+	memmove(changes->items + first_change, changes->items + written_end, (changes->size - written_end) * sizeof(CellDelta));
+	changes->size -= written_end - first_change;
+
+	return changes->size == first_change ? FILL_UNCHANGED : FILL_DONE;
+}
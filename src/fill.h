@@ -0,0 +1,23 @@
+#pragma once
+
+#include "history.h"
+#include "tilemap.h"
+
+typedef enum
+{
+	FILL_DONE,
+	FILL_UNCHANGED, // The cells already had the content
+	FILL_TOO_BIG, // More than max_cells cells, the grid is left unchanged
+	// A chunk has no room for the tint and its closest one is the content being replaced, so the
+	// region would never stop matching. The grid is left unchanged.
+	FILL_TOO_MANY_TINTS,
+} FillResult;
+
+// Fill tools write the grid a row at a time and append the rows they changed to changes,
+// with layer as their layer and the content the grid stored as their after value (a tint can be
+// approximated, see CHUNK_TINTS). tile NULL erases, the tilemap_index of tile is ignored.
+
+// Fills the 4-connected region of cells with the same content as start (no tile being a content too)
+FillResult flood_fill(TileGrid* grid, uint32_t layer, Vec2i start, const Tile* tile, size_t max_cells, CellDeltas* changes);
+// Fills the rectangle between two corner cells, both included
+FillResult fill_rectangle(TileGrid* grid, uint32_t layer, Vec2i a, Vec2i b, const Tile* tile, size_t max_cells, CellDeltas* changes);
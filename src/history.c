@@ -0,0 +1,247 @@
+#include "history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+#define STROKE_SLOTS_INIT_CAPACITY 256
+
+CellValue get_cell_value(const Tile* tile)
+{
+	if (!tile)
+		return (CellValue){ .texture_index = HISTORY_EMPTY };
+
+	return (CellValue){ .texture_index = (uint32_t)tile->texture_index, .tint = tile->tint };
+}
+
+bool cell_value_equals(CellValue a, CellValue b)
+{
+	return a.texture_index == b.texture_index &&
+		(a.texture_index == HISTORY_EMPTY || memcmp(&a.tint, &b.tint, sizeof(Color)) == 0);
+}
+
+static size_t get_entry_memory(const HistoryEntry* entry)
+{
+	return sizeof(HistoryEntry) + entry->capacity * sizeof(CellDelta);
+}
+
+static size_t hash_cell(uint32_t layer, Vec2i index)
+{
+	return hash_vec2i(index) ^ ((size_t)layer * 0x9e3779b97f4a7c15ULL);
+}
+
+static size_t find_stroke_slot(const History* history, uint32_t layer, Vec2i index)
+{
+	size_t mask = history->stroke_slots_capacity - 1;
+	size_t slot = hash_cell(layer, index) & mask;
+	while (history->stroke_slots[slot] != 0)
+	{
+		const CellDelta* delta = &history->stroke.items[history->stroke_slots[slot] - 1];
+		if (delta->layer == layer && vec2i_equals(delta->index, index))
+			break;
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+static bool grow_stroke_slots(History* history)
+{
+	size_t capacity = history->stroke_slots_capacity == 0 ? STROKE_SLOTS_INIT_CAPACITY : history->stroke_slots_capacity * 2;
+	uint32_t* slots = calloc(capacity, sizeof(uint32_t));
+	if (!slots)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return false;
+	}
+
+	free(history->stroke_slots);
+	history->stroke_slots = slots;
+	history->stroke_slots_capacity = capacity;
+
+	for (size_t i = 0; i < history->stroke.size; i++)
+	{
+		const CellDelta* delta = &history->stroke.items[i];
+		history->stroke_slots[find_stroke_slot(history, delta->layer, delta->index)] = (uint32_t)i + 1;
+	}
+
+	return true;
+}
+
+void history_record(History* history, uint32_t layer, Vec2i index, CellValue before, CellValue after)
+{
+	if (!history)
+		return;
+
+	history->recording = true;
+
+	// Same load factor as the chunk directory
+	if ((history->stroke.size + 1) * 10 > history->stroke_slots_capacity * 7 && !grow_stroke_slots(history))
+		return;
+
+	size_t slot = find_stroke_slot(history, layer, index);
+	if (history->stroke_slots[slot] != 0)
+	{
+		history->stroke.items[history->stroke_slots[slot] - 1].after = after;
+		return;
+	}
+
+	CellDelta delta = { .index = index, .layer = layer, .length = 1, .before = before, .after = after };
+	da_append(history->stroke, delta);
+	history->stroke_slots[slot] = (uint32_t)history->stroke.size;
+}
+
+static void free_entry(History* history, HistoryEntry* entry)
+{
+	history->memory -= get_entry_memory(entry);
+	free(entry->items);
+	*entry = (HistoryEntry){0};
+}
+
+static void enforce_memory_limit(History* history)
+{
+	size_t limit = history->memory_limit == 0 ? HISTORY_DEFAULT_MEMORY_LIMIT : history->memory_limit;
+
+	size_t dropped = 0;
+	while (dropped < history->size && history->memory > limit)
+		free_entry(history, &history->items[dropped++]);
+
+	if (dropped == 0)
+		return;
+
+	memmove(history->items, history->items + dropped, (history->size - dropped) * sizeof(HistoryEntry));
+	history->size -= dropped;
+	history->current = history->current > dropped ? history->current - dropped : 0;
+}
+
+void history_end_stroke(History* history)
+{
+	if (!history || !history->recording)
+		return;
+
+	history->recording = false;
+	if (history->stroke_slots_capacity > 0)
+		memset(history->stroke_slots, 0, history->stroke_slots_capacity * sizeof(uint32_t));
+
+	// Cells changed back to what they had
+	HistoryEntry entry = history->stroke;
+	history->stroke = (HistoryEntry){0};
+	size_t kept = 0;
+	for (size_t i = 0; i < entry.size; i++)
+	{
+		if (!cell_value_equals(entry.items[i].before, entry.items[i].after))
+			entry.items[kept++] = entry.items[i];
+	}
+	entry.size = kept;
+
+	if (entry.size == 0)
+	{
+		free(entry.items);
+		return;
+	}
+
+	// Keep only what is used, the history holds many entries
+	CellDelta* items = realloc(entry.items, entry.size * sizeof(CellDelta));
+	if (items)
+	{
+		entry.items = items;
+		entry.capacity = entry.size;
+	}
+
+	// A new step replaces the steps that could be redone
+	for (size_t i = history->current; i < history->size; i++)
+		free_entry(history, &history->items[i]);
+	history->size = history->current;
+
+	history->memory += get_entry_memory(&entry);
+	da_append(*history, entry);
+	history->current = history->size;
+
+	enforce_memory_limit(history);
+}
+
+void history_push(History* history, const CellDelta* deltas, size_t count)
+{
+	if (!history || count == 0)
+		return;
+
+	history_end_stroke(history);
+
+	da_reserve(history->stroke, count);
+	if (!history->stroke.items)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		history->stroke.capacity = 0;
+		return;
+	}
+	memcpy(history->stroke.items, deltas, count * sizeof(CellDelta));
+	history->stroke.size = count;
+
+	history->recording = true;
+	history_end_stroke(history);
+}
+
+const HistoryEntry* history_undo(History* history)
+{
+	if (!history)
+		return NULL;
+
+	history_end_stroke(history);
+	if (history->current == 0)
+		return NULL;
+
+	history->current--;
+	return &history->items[history->current];
+}
+
+const HistoryEntry* history_redo(History* history)
+{
+	if (!history)
+		return NULL;
+
+	history_end_stroke(history);
+	if (history->current == history->size)
+		return NULL;
+
+	history->current++;
+	return &history->items[history->current - 1];
+}
+
+void history_set_memory_limit(History* history, size_t memory_limit)
+{
+	if (!history)
+		return;
+
+	history->memory_limit = memory_limit;
+	enforce_memory_limit(history);
+}
+
+void history_clear(History* history)
+{
+	if (!history)
+		return;
+
+	for (size_t i = 0; i < history->size; i++)
+		free_entry(history, &history->items[i]);
+	history->size = 0;
+	history->current = 0;
+
+	history->recording = false;
+	history->stroke.size = 0;
+	if (history->stroke_slots_capacity > 0)
+		memset(history->stroke_slots, 0, history->stroke_slots_capacity * sizeof(uint32_t));
+}
+
+void history_free(History* history)
+{
+	if (!history)
+		return;
+
+	history_clear(history);
+	free(history->items);
+	free(history->stroke.items);
+	free(history->stroke_slots);
+	*history = (History){0};
+}
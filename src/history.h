@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tilemap.h"
+
+// Default memory cap of the undo history
+#define HISTORY_DEFAULT_MEMORY_LIMIT (64 * 1024 * 1024)
+// texture_index of an empty cell
+#define HISTORY_EMPTY UINT32_MAX
+
+typedef struct
+{
+	uint32_t texture_index; // HISTORY_EMPTY when there is no tile
+	Color tint;
+} CellValue;
+
+// Content of length cells of a row, from index to the right, before and after an edit
+typedef struct
+{
+	Vec2i index;
+	uint32_t layer; // 0 is the main layer, i + 1 is layers.items[i]
+	uint32_t length;
+	CellValue before;
+	CellValue after;
+} CellDelta;
+
+typedef struct
+{
+	CellDelta* items;
+	size_t size;
+	size_t capacity;
+} CellDeltas;
+
+// One undo step: every cell changed by a stroke or a fill, each cell once
+typedef CellDeltas HistoryEntry;
+
+typedef struct
+{
+	HistoryEntry* items;
+	size_t size;
+	size_t capacity;
+	size_t current; // items[0, current) can be undone, items[current, size) redone
+	size_t memory; // Bytes used by the entries
+	size_t memory_limit; // The oldest entries are dropped above it, 0 means HISTORY_DEFAULT_MEMORY_LIMIT
+
+	// Stroke being recorded, cells already in it are found through a hash map
+	bool recording;
+	HistoryEntry stroke;
+	uint32_t* stroke_slots; // Index in stroke + 1, 0 is empty
+	size_t stroke_slots_capacity;
+} History;
+
+CellValue get_cell_value(const Tile* tile);
+bool cell_value_equals(CellValue a, CellValue b);
+
+// Records that a cell changed, the changes until history_end_stroke become one undo step.
+// A cell changed several times keeps its first before and its last after value.
+void history_record(History* history, uint32_t layer, Vec2i index, CellValue before, CellValue after);
+// Ends the stroke being recorded, then adds the deltas as one undo step
+void history_push(History* history, const CellDelta* deltas, size_t count);
+// Ends the stroke being recorded, if any. Drops the redo steps and the oldest steps above the limit.
+void history_end_stroke(History* history);
+
+// Return the step to apply (its before values for undo, after values for redo), or NULL if there is none
+const HistoryEntry* history_undo(History* history);
+const HistoryEntry* history_redo(History* history);
+
+void history_set_memory_limit(History* history, size_t memory_limit);
+// Forgets every step, for when the tilemap changed in a way the steps don't know about
+void history_clear(History* history);
+void history_free(History* history);
@@ -1,10 +1,24 @@
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <raylib.h>
 #include <raymath.h>
+#include <math.h>
+#include <float.h>
 #include <string.h>
 
 #include "tilemap.h"
+#include "static_index.h"
+#include "tile_renderer.h"
+#include "async_save.h"
+#include "async_import.h"
+#include "async_load.h"
+#include "history.h"
+#include "brush.h"
+#include "fill.h"
+#include "profiler.h"
+#include "trace.h"
+#include "tilemap_file.h"
 #include "utils.h"
 #include "file_picker.h"
 
@@ -16,11 +30,72 @@
 #define IMGUI_BUFFER_SIZE 512
 #define CAMERA_SPEED 600
 #define CAMERA_ZOOM_FACTOR 1.5f
+// Zoomed out views draw chunk impostors, so whole maps can be shown
+#define CAMERA_MIN_ZOOM 0.1f
+// Seconds the result of a save stays in the menu bar
+#define SAVE_STATUS_DURATION 3.0
+// Once the journal is this big it is folded back into the tilemap file by a full save
+#define JOURNAL_COMPACT_SIZE (4 * 1024 * 1024)
+// Edits of more cells are not journaled, they would flood it: the next save is a full one instead
+#define JOURNAL_MAX_EDIT_CELLS (JOURNAL_COMPACT_SIZE / JOURNAL_RECORD_SIZE)
+// Fill tools give up on bigger areas (an open region fills until the limit), can be changed in the tools window
+#define FILL_DEFAULT_MAX_CELLS (4 * 1024 * 1024)
+#define FILL_MAX_CELLS_LIMIT (64 * 1024 * 1024)
+// Atlas pages uploaded per frame, a freshly opened map shows up page by page instead of stalling
+#define ATLAS_UPLOADS_PER_FRAME 2
+// Range of the undo history memory setting, in MB
+#define HISTORY_MIN_MEMORY_MB 1
+#define HISTORY_MAX_MEMORY_MB 1024
+
+typedef enum
+{
+	TOOL_BRUSH,
+	TOOL_FILL,
+	TOOL_RECTANGLE,
+} Tool;
+
+// Textures selected with ctrl+click in the tile selector, one flag per texture
+typedef struct
+{
+	bool* items;
+	size_t size;
+	size_t capacity;
+} TextureSelection;
+
+// Textures of one tileset in the tile palette, or of no tileset when tileset is -1
+typedef struct
+{
+	long tileset;
+	char label[IMGUI_BUFFER_SIZE]; // Header text and ImGui ID
+	size_t first; // Into Palette.textures
+	size_t count;
+} PaletteGroup;
+
+typedef struct
+{
+	PaletteGroup* items;
+	size_t size;
+	size_t capacity;
+} PaletteGroups;
+
+// What the tile palette shows, rebuilt only when the textures or the filter change
+typedef struct
+{
+	char filter[IMGUI_BUFFER_SIZE];
+	bool dirty; // Set when the tilemap is replaced
+	uint64_t revision; // Tilemap revision the groups were built for
+	size_t texture_count;
+	size_t tileset_count;
+
+	Indices textures; // Textures passing the filter, grouped
+	PaletteGroups groups;
+} Palette;
 
 typedef struct
 {
 	Camera2D camera;
 	Tilemap tilemap;
+	TileRenderer renderer;
 	size_t current_texture;
 
 	char* tilemap_filepath;
@@ -28,8 +103,63 @@ typedef struct
 	Rectangle viewport_bounds;
 	RenderTexture2D viewport;
 
+	// The viewport texture is only redrawn when something changed since the last draw
+	bool viewport_dirty; // Redraw everything
+	bool has_dirty_area;
+	Rectangle dirty_area; // World space area touched by edits, redrawn alone when nothing else changed
+	Camera2D drawn_camera;
+	uint64_t drawn_revision;
+	uint64_t known_revision; // Revision after the last edit that marked its area
+
+	// Saves run in the background, the result is shown in the menu bar for a while
+	AsyncSave save;
+	const char* save_status;
+	double save_status_time;
+
+	// Files are opened in the background, editing waits until the tilemap is in
+	AsyncLoad load;
+	size_t pending_uploads; // Atlas pages not on the GPU yet
+
+	// Tilesets are sliced in the background, the popup shows the progress
+	AsyncImport import;
+	bool import_failed;
+
+	// Grid edits are appended to the journal of the tilemap file as they happen,
+	// saving only has to flush it until a full save compacts it
+	Journal journal;
+	// State of the running full save, to compact the journal once it is done
+	char* saving_filepath;
+	uint64_t saving_journal_offset; // Journal size when the snapshot was taken
+	uint64_t saving_revision; // Structure revision of the snapshot
+	uint64_t saving_tilemap_revision;
+	bool saving_with_journal; // Edits made during the save are in the journal
+
+	// Grid edits, a stroke lasts while a mouse button is held
+	History history;
+
+	Tool tool;
+	const char* tool_status; // Why the last fill did nothing, NULL if it worked
+
+	// The brush covers the mouse path between frames, so fast drags leave no gaps
+	Brush brush;
+	bool painting; // A stroke is going on, last_paint_cell is where the mouse was
+	Vec2i last_paint_cell;
+	CellList stroke_cells; // Reused every frame
+
+	int fill_max_cells;
+	CellDeltas fill_changes; // Reused by every fill
+	bool rectangle_dragging; // The rectangle goes from rectangle_start to the cell under the mouse
+	bool rectangle_erases;
+	Vec2i rectangle_start;
+
+	// Stage timings, only taken while the profiler window shows them
+	Profiler profiler;
+	bool show_profiler;
+
 	// Imgui data
 	bool show_add_tileset_popup;
+	TextureSelection selected_textures;
+	Palette palette;
 } CoreData;
 
 Vector2 get_mouse_pos_on_viewport(CoreData* data)
@@ -48,40 +178,359 @@ Vector2 get_mouse_pos_in_2d_world(CoreData* data)
 	return GetScreenToWorld2D(result, data->camera);
 }
 
-int get_tile_index_collides_with_mouse(CoreData* data, const Layer* layer)
+Vector2 get_mouse_pos_in_layer(CoreData* data, const Layer* layer)
 {
-	if (!layer || !data)
-		return -1;
+	Vector2 result = get_mouse_pos_in_2d_world(data);
 
-	Vector2 mouse_pos = get_mouse_pos_in_2d_world(data);
+	result.x -= data->tilemap.offset.x + layer->offset.x;
+	result.y -= data->tilemap.offset.y + layer->offset.y;
+
+	return result;
+}
 
-	for (size_t i = 0; i < layer->tiles.size; i++)
+Vec2i get_tile_index_under_mouse(CoreData* data, const Layer* layer)
+{
+	int profile = profile_begin(&data->profiler, PROFILE_PICKING);
+	Vector2 mouse_pos = get_mouse_pos_in_layer(data, layer);
+
+	Vec2i result =
 	{
-		Rectangle tile_rect =
-		{
-			.x = layer->offset.x + layer->tiles.items[i].tilemap_index.x,
-			.y = layer->offset.y + layer->tiles.items[i].tilemap_index.y,
-			.width = 1.0f,
-			.height = 1.0f,
-		};
+		.x = (int)floorf(mouse_pos.x),
+		.y = (int)floorf(mouse_pos.y),
+	};
+
+	profile_end(&data->profiler, profile);
+	return result;
+}
+
+// Area of the world visible in the viewport
+Rectangle get_camera_view(CoreData* data)
+{
+	Vector2 top_left = GetScreenToWorld2D(Vector2Zero(), data->camera);
+	Vector2 bottom_right = GetScreenToWorld2D((Vector2){data->viewport.texture.width, data->viewport.texture.height}, data->camera);
+
+	Rectangle result =
+	{
+		.x = top_left.x,
+		.y = top_left.y,
+		.width = bottom_right.x - top_left.x,
+		.height = bottom_right.y - top_left.y,
+	};
+
+	return result;
+}
+
+bool camera_equals(Camera2D a, Camera2D b)
+{
+	return a.offset.x == b.offset.x && a.offset.y == b.offset.y &&
+		a.target.x == b.target.x && a.target.y == b.target.y &&
+		a.rotation == b.rotation && a.zoom == b.zoom;
+}
+
+// Call before changing the tilemap from the editor
+void begin_edit(CoreData* data)
+{
+	// Something changed the tilemap without marking its area
+	if (get_tilemap_revision(&data->tilemap) != data->known_revision)
+		data->viewport_dirty = true;
+}
+
+// Smallest rectangle containing both
+Rectangle merge_areas(Rectangle a, Rectangle b)
+{
+	float right = fmaxf(a.x + a.width, b.x + b.width);
+	float bottom = fmaxf(a.y + a.height, b.y + b.height);
+
+	Rectangle result = { .x = fminf(a.x, b.x), .y = fminf(a.y, b.y) };
+	result.width = right - result.x;
+	result.height = bottom - result.y;
+
+	return result;
+}
 
-		if (CheckCollisionPointRec(mouse_pos, tile_rect))
-			return i;
+// Call after changing the tilemap, area is in world space
+void end_edit(CoreData* data, Rectangle area)
+{
+	data->dirty_area = data->has_dirty_area ? merge_areas(data->dirty_area, area) : area;
+	data->has_dirty_area = true;
+	data->known_revision = get_tilemap_revision(&data->tilemap);
+}
+
+// Area of length cells of a row, from tile_index to the right
+Rectangle get_row_area(CoreData* data, const Layer* layer, Vec2i tile_index, int length)
+{
+	Rectangle result =
+	{
+		.x = data->tilemap.offset.x + layer->offset.x + tile_index.x,
+		.y = data->tilemap.offset.y + layer->offset.y + tile_index.y,
+		.width = (float)length,
+		.height = 1.0f,
+	};
+
+	return result;
+}
+
+Rectangle get_static_tile_area(CoreData* data, const Layer* layer, Tile tile)
+{
+	Rectangle result = tile.bounds;
+	result.x += data->tilemap.offset.x + layer->offset.x;
+	result.y += data->tilemap.offset.y + layer->offset.y;
+
+	return result;
+}
+
+// Layer number used by the journal and the file format
+uint32_t get_layer_number(CoreData* data, const Layer* layer)
+{
+	if (layer == &data->tilemap.main_layer)
+		return 0;
+
+	return (uint32_t)(layer - data->tilemap.layers.items) + 1;
+}
+
+Layer* get_layer_by_number(CoreData* data, uint32_t number)
+{
+	if (number == 0)
+		return &data->tilemap.main_layer;
+	if (number > data->tilemap.layers.size)
+		return NULL;
+
+	return &data->tilemap.layers.items[number - 1];
+}
+
+// Whether an edit of cell_count cells goes to the journal
+bool journal_edit(CoreData* data, size_t cell_count)
+{
+	if (!journal_accepts(&data->journal, &data->tilemap))
+		return false;
+	if (cell_count <= JOURNAL_MAX_EDIT_CELLS)
+		return true;
+
+	// Too big, the next save writes everything. A running save can't be taken as complete either.
+	data->journal.base_revision = UINT64_MAX;
+	data->saving_with_journal = false;
+	return false;
+}
+
+// Records the cells of a row as the grid stores them, a tint written may have been approximated
+void journal_row(CoreData* data, Layer* layer, Vec2i start, int length)
+{
+	uint32_t layer_number = get_layer_number(data, layer);
+	for (int i = 0; i < length; i++)
+	{
+		Vec2i tile_index = { start.x + i, start.y };
+		Tile tile;
+		if (tile_grid_get(&layer->tiles, tile_index, &tile))
+			journal_record_set(&data->journal, layer_number, tile);
+		else
+			journal_record_erase(&data->journal, layer_number, tile_index);
 	}
+}
 
-	return -1;
+// Changes length cells of a row without recording them in the history, value.texture_index HISTORY_EMPTY erases them
+void write_row(CoreData* data, Layer* layer, Vec2i start, int length, CellValue value, bool journal)
+{
+	Tile tile = { .texture_index = value.texture_index, .tint = value.tint };
+	tile_grid_fill_row(&layer->tiles, start, length, value.texture_index == HISTORY_EMPTY ? NULL : &tile);
+
+	if (journal)
+		journal_row(data, layer, start, length);
+}
+
+// Sets the cells (sorted with sort_cells) to value in one edit, value.texture_index HISTORY_EMPTY erases them
+void paint_cells(CoreData* data, Layer* layer, const CellList* cells, CellValue value)
+{
+	begin_edit(data);
+
+	bool journal = journal_edit(data, cells->size);
+	uint32_t layer_number = get_layer_number(data, layer);
+	Rectangle area = {0};
+	bool changed = false;
+	for (size_t i = 0; i < cells->size; i++)
+	{
+		Vec2i tile_index = cells->items[i];
+		Tile tile;
+		CellValue before = get_cell_value(tile_grid_get(&layer->tiles, tile_index, &tile) ? &tile : NULL);
+		if (cell_value_equals(before, value))
+			continue;
+
+		write_row(data, layer, tile_index, 1, value, journal);
+
+		// The history gets what was stored, so undo and redo give back the same cells
+		CellValue after = get_cell_value(tile_grid_get(&layer->tiles, tile_index, &tile) ? &tile : NULL);
+		if (cell_value_equals(before, after))
+			continue;
+		history_record(&data->history, layer_number, tile_index, before, after);
+
+		Rectangle cell = get_row_area(data, layer, tile_index, 1);
+		area = changed ? merge_areas(area, cell) : cell;
+		changed = true;
+	}
+
+	if (changed)
+		end_edit(data, area);
+}
+
+// Writes the before (undo) or after (redo) values of a history step, in one edit
+void apply_history_entry(CoreData* data, const HistoryEntry* entry, bool undo)
+{
+	if (!entry)
+		return;
+
+	begin_edit(data);
+
+	size_t cell_count = 0;
+	for (size_t i = 0; i < entry->size; i++)
+		cell_count += entry->items[i].length;
+	bool journal = journal_edit(data, cell_count);
+
+	Rectangle area = {0};
+	bool changed = false;
+	for (size_t i = 0; i < entry->size; i++)
+	{
+		// Undo in reverse, in case the step holds a cell twice
+		const CellDelta* delta = &entry->items[undo ? entry->size - 1 - i : i];
+		Layer* layer = get_layer_by_number(data, delta->layer);
+		if (!layer)
+			continue;
+
+		write_row(data, layer, delta->index, (int)delta->length, undo ? delta->before : delta->after, journal);
+
+		Rectangle row = get_row_area(data, layer, delta->index, (int)delta->length);
+		area = changed ? merge_areas(area, row) : row;
+		changed = true;
+	}
+
+	if (changed)
+		end_edit(data, area);
+}
+
+void undo(CoreData* data)
+{
+	apply_history_entry(data, history_undo(&data->history), true);
+}
+
+void redo(CoreData* data)
+{
+	apply_history_entry(data, history_redo(&data->history), false);
+}
+
+// Journals and records as one undo step the rows a fill tool changed, the grid already has them
+void finish_fill(CoreData* data, Layer* layer, FillResult result)
+{
+	if (result == FILL_TOO_BIG)
+		data->tool_status = "Area larger than the fill limit";
+	else if (result == FILL_TOO_MANY_TINTS)
+		data->tool_status = "Too many tints in a chunk of the area";
+	else
+		data->tool_status = NULL;
+	if (result != FILL_DONE)
+		return;
+
+	const CellDeltas* changes = &data->fill_changes;
+	size_t cell_count = 0;
+	for (size_t i = 0; i < changes->size; i++)
+		cell_count += changes->items[i].length;
+	bool journal = journal_edit(data, cell_count);
+
+	Rectangle area = get_row_area(data, layer, changes->items[0].index, (int)changes->items[0].length);
+	for (size_t i = 0; i < changes->size; i++)
+	{
+		const CellDelta* delta = &changes->items[i];
+		if (journal)
+			journal_row(data, layer, delta->index, (int)delta->length);
+		area = merge_areas(area, get_row_area(data, layer, delta->index, (int)delta->length));
+	}
+
+	end_edit(data, area);
+	history_push(&data->history, changes->items, changes->size);
+}
+
+void fill_region(CoreData* data, Layer* layer, Vec2i start, CellValue value)
+{
+	Tile tile = { .texture_index = value.texture_index, .tint = value.tint };
+
+	begin_edit(data);
+	data->fill_changes.size = 0;
+	FillResult result = flood_fill(&layer->tiles, get_layer_number(data, layer), start,
+		value.texture_index == HISTORY_EMPTY ? NULL : &tile, (size_t)data->fill_max_cells, &data->fill_changes);
+	finish_fill(data, layer, result);
+}
+
+void fill_area(CoreData* data, Layer* layer, Vec2i a, Vec2i b, CellValue value)
+{
+	Tile tile = { .texture_index = value.texture_index, .tint = value.tint };
+
+	begin_edit(data);
+	data->fill_changes.size = 0;
+	FillResult result = fill_rectangle(&layer->tiles, get_layer_number(data, layer), a, b,
+		value.texture_index == HISTORY_EMPTY ? NULL : &tile, (size_t)data->fill_max_cells, &data->fill_changes);
+	finish_fill(data, layer, result);
+}
+
+void place_static_tile(CoreData* data, Layer* layer, Tile tile)
+{
+	begin_edit(data);
+	add_static_tile(layer, tile);
+	end_edit(data, get_static_tile_area(data, layer, tile));
+}
+
+void erase_static_tile(CoreData* data, Layer* layer, size_t index)
+{
+	begin_edit(data);
+	Rectangle area = get_static_tile_area(data, layer, layer->static_tiles.items[index]);
+	remove_static_tile(layer, index);
+	end_edit(data, area);
 }
 
 void draw_viewport(CoreData* data)
 {
+	uint64_t revision = get_tilemap_revision(&data->tilemap);
+	bool camera_changed = !camera_equals(data->camera, data->drawn_camera);
+	bool tilemap_changed = revision != data->drawn_revision;
+
+	// Nothing changed, keep the previous frame
+	if (!data->viewport_dirty && !camera_changed && !tilemap_changed)
+		return;
+
+	int profile = profile_begin(&data->profiler, PROFILE_DRAW_VIEWPORT);
+
+	// Only edits with a known area happened: redraw just that area
+	bool partial = !data->viewport_dirty && !camera_changed && data->has_dirty_area && revision == data->known_revision;
+
+	Rectangle view = get_camera_view(data);
 	BeginTextureMode(data->viewport);
+
+	if (partial)
+	{
+		Vector2 top_left = GetWorldToScreen2D((Vector2){data->dirty_area.x, data->dirty_area.y}, data->camera);
+		Vector2 bottom_right = GetWorldToScreen2D((Vector2){data->dirty_area.x + data->dirty_area.width, data->dirty_area.y + data->dirty_area.height}, data->camera);
+		int x = (int)floorf(top_left.x) - 1;
+		int y = (int)floorf(top_left.y) - 1;
+		BeginScissorMode(x, y, (int)ceilf(bottom_right.x) + 1 - x, (int)ceilf(bottom_right.y) + 1 - y);
+		view = data->dirty_area;
+	}
+
 	ClearBackground(WHITE);
 
 	BeginMode2D(data->camera);
-	draw_tilemap(&data->tilemap);
+	data->renderer.zoom = data->camera.zoom;
+	data->renderer.partial = partial;
+	draw_tilemap(&data->tilemap, view, &data->renderer);
 	EndMode2D();
 
+	if (partial)
+		EndScissorMode();
+
 	EndTextureMode();
+
+	data->viewport_dirty = false;
+	data->has_dirty_area = false;
+	data->drawn_camera = data->camera;
+	data->drawn_revision = revision;
+	data->known_revision = revision;
+
+	profile_end(&data->profiler, profile);
 }
 
 void set_imgui_style(void)
@@ -109,16 +558,146 @@ void viewport_window(CoreData* data)
 	{
 		UnloadRenderTexture(data->viewport);
 		data->viewport = LoadRenderTexture(data->viewport_bounds.width, data->viewport_bounds.height);
+		data->viewport_dirty = true;
 	}
 
 	// Render viewport
 	draw_viewport(data);
 	rlImGuiImageRenderTexture(&data->viewport);
 
+	// Outline of the rectangle being dragged, drawn over the cached viewport
+	if (data->rectangle_dragging)
+	{
+		Vec2i end = get_tile_index_under_mouse(data, &data->tilemap.main_layer);
+		Rectangle area = merge_areas(get_row_area(data, &data->tilemap.main_layer, data->rectangle_start, 1),
+			get_row_area(data, &data->tilemap.main_layer, end, 1));
+		Vector2 top_left = GetWorldToScreen2D((Vector2){ area.x, area.y }, data->camera);
+		Vector2 bottom_right = GetWorldToScreen2D((Vector2){ area.x + area.width, area.y + area.height }, data->camera);
+
+		ImVec2 min = { data->viewport_bounds.x + top_left.x, data->viewport_bounds.y + top_left.y };
+		ImVec2 max = { data->viewport_bounds.x + bottom_right.x, data->viewport_bounds.y + bottom_right.y };
+		ImU32 color = igGetColorU32_Vec4(data->rectangle_erases ? (ImVec4){ 1.0f, 0.2f, 0.2f, 1.0f } : (ImVec4){ 0.2f, 0.6f, 1.0f, 1.0f });
+		ImDrawList_AddRect(igGetWindowDrawList(), min, max, color, 0.0f, ImDrawFlags_None, 2.0f);
+	}
+
 	igEnd();
 	igPopStyleVar(1);
 }
 
+bool tile_image_button(const char* name, const Tilemap* tilemap, size_t texture_index, ImVec2 size)
+{
+	AtlasRegion region = tilemap->textures.items[texture_index];
+	const AtlasPage* page = tilemap->atlas.items[region.page];
+
+	// The page is still waiting for its upload
+	if (page->texture.id == 0)
+		return igButtonEx(name, size, ImGuiButtonFlags_None);
+
+	ImVec2 uv0 = { region.source.x / page->image.width, region.source.y / page->image.height };
+	ImVec2 uv1 =
+	{
+		(region.source.x + region.source.width) / page->image.width,
+		(region.source.y + region.source.height) / page->image.height,
+	};
+
+	// rlImGui uses a pointer to the Texture as the ImTextureID
+	return igImageButton(name, (ImTextureID)&page->texture, size, uv0, uv1, (ImVec4){0.0f, 0.0f, 0.0f, 0.0f}, (ImVec4){1.0f, 1.0f, 1.0f, 1.0f});
+}
+
+// Index of the tileset holding the texture, -1 if it is in none
+long get_texture_tileset(const Tilemap* tilemap, size_t texture_index)
+{
+	for (size_t i = 0; i < tilemap->tilesets.size; i++)
+	{
+		const Tileset* tileset = &tilemap->tilesets.items[i];
+		if (texture_index >= tileset->first_texture && texture_index - tileset->first_texture < tileset->texture_count)
+			return (long)i;
+	}
+
+	return -1;
+}
+
+void clear_texture_selection(CoreData* data)
+{
+	for (size_t i = 0; i < data->selected_textures.size; i++)
+		data->selected_textures.items[i] = false;
+}
+
+// Case insensitive
+bool palette_filter_matches(const char* text, const char* filter)
+{
+	size_t length = strlen(filter);
+	for (const char* start = text; *start; start++)
+	{
+		if (strncasecmp(start, filter, length) == 0)
+			return true;
+	}
+
+	return length == 0;
+}
+
+void append_palette_group(Palette* palette, long tileset, const char* name,
+	size_t first_texture, size_t texture_count, const bool* in_tileset)
+{
+	PaletteGroup group = { .tileset = tileset, .first = palette->textures.size };
+
+	// A matching name shows the whole group, otherwise only the textures whose number matches
+	bool name_matches = palette_filter_matches(name, palette->filter);
+	for (size_t i = first_texture; i < first_texture + texture_count; i++)
+	{
+		if (in_tileset && in_tileset[i])
+			continue;
+
+		char number[32];
+		snprintf(number, sizeof(number), "%zu", i);
+		if (name_matches || palette_filter_matches(number, palette->filter))
+			da_append(palette->textures, i);
+	}
+
+	group.count = palette->textures.size - group.first;
+	if (group.count == 0)
+		return;
+
+	snprintf(group.label, sizeof(group.label), "%s (%zu)###group %ld", name, group.count, tileset);
+	da_append(palette->groups, group);
+}
+
+void update_palette(Palette* palette, const Tilemap* tilemap)
+{
+	if (!palette->dirty && palette->revision == tilemap->revision &&
+		palette->texture_count == tilemap->textures.size && palette->tileset_count == tilemap->tilesets.size)
+		return;
+
+	palette->dirty = false;
+	palette->revision = tilemap->revision;
+	palette->texture_count = tilemap->textures.size;
+	palette->tileset_count = tilemap->tilesets.size;
+	palette->textures.size = 0;
+	palette->groups.size = 0;
+
+	bool* in_tileset = calloc(tilemap->textures.size + 1, sizeof(bool));
+	if (!in_tileset)
+		return;
+
+	for (size_t i = 0; i < tilemap->tilesets.size; i++)
+	{
+		const Tileset* tileset = &tilemap->tilesets.items[i];
+		append_palette_group(palette, (long)i, tileset->name, tileset->first_texture, tileset->texture_count, NULL);
+		for (size_t j = 0; j < tileset->texture_count; j++)
+			in_tileset[tileset->first_texture + j] = true;
+	}
+
+	append_palette_group(palette, -1, "Other textures", 0, tilemap->textures.size, in_tileset);
+	free(in_tileset);
+}
+
+void unload_palette(Palette* palette)
+{
+	free(palette->textures.items);
+	free(palette->groups.items);
+	*palette = (Palette){0};
+}
+
 void tile_selector_window(CoreData* data)
 {
 	igBegin("Tile select", NULL, ImGuiWindowFlags_None);
@@ -134,33 +713,102 @@ void tile_selector_window(CoreData* data)
 	if (items_per_row <= 0)
 		items_per_row = 1;
 
-	int to_remove = -1;
-	for (size_t i = 0; i < data->tilemap.textures.size; i++)
-	{
-		int item_idx = i % items_per_row;
-		if (item_idx != 0)
-			igSameLine(0, -1);
-
+	// One flag per texture
+	TextureSelection* selection = &data->selected_textures;
+	while (selection->size < data->tilemap.textures.size)
+		da_append(*selection, false);
+	selection->size = data->tilemap.textures.size;
 
-		bool is_selected = i == data->current_texture;
-		if (is_selected)
-			igPushStyleColor_Vec4(ImGuiCol_Button, *igGetStyleColorVec4(ImGuiCol_ButtonActive));
+	size_t selected_count = 0;
+	for (size_t i = 0; i < selection->size; i++)
+		selected_count += selection->items[i];
 
-		if (rlImGuiImageButtonSize(TextFormat("Tile %zu", i), &data->tilemap.textures.items[i], item_size))
-			data->current_texture = i;
+	int to_remove = -1;
+	bool remove_selection = false;
+	long tileset_to_remove = -1;
+
+	// Matches tileset names and texture numbers
+	igSetNextItemWidth(-FLT_MIN);
+	if (igInputTextWithHint("##filter", "Filter", data->palette.filter, IMGUI_BUFFER_SIZE, ImGuiInputTextFlags_None, NULL, NULL))
+		data->palette.dirty = true;
+
+	// Only the rows in view are submitted, one clipper per group
+	update_palette(&data->palette, &data->tilemap);
+	ImGuiListClipper* clipper = ImGuiListClipper_ImGuiListClipper();
+	for (size_t g = 0; g < data->palette.groups.size; g++)
+	{
+		const PaletteGroup* group = &data->palette.groups.items[g];
+		if (!igCollapsingHeader_TreeNodeFlags(group->label, ImGuiTreeNodeFlags_DefaultOpen))
+			continue;
 
-		// Context menu
-		if (igBeginPopupContextItem(TextFormat("Tile %zu context", i), ImGuiPopupFlags_MouseButtonRight))
+		int rows = (int)((group->count + items_per_row - 1) / items_per_row);
+		ImGuiListClipper_Begin(clipper, rows, -1.0f);
+		while (ImGuiListClipper_Step(clipper))
 		{
-			if (igMenuItem_Bool("Delete", NULL, false, true))
-				to_remove = i;
-
-			igEndPopup();
+			for (int row = clipper->DisplayStart; row < clipper->DisplayEnd; row++)
+			{
+				size_t row_start = (size_t)row * items_per_row;
+				size_t row_end = row_start + items_per_row < group->count ? row_start + items_per_row : group->count;
+				for (size_t k = row_start; k < row_end; k++)
+				{
+					size_t i = data->palette.textures.items[group->first + k];
+					if (k != row_start)
+						igSameLine(0, -1);
+
+					igPushID_Int((int)i);
+
+					bool is_selected = i == data->current_texture;
+					bool is_marked = selection->items[i];
+					if (is_selected)
+						igPushStyleColor_Vec4(ImGuiCol_Button, *igGetStyleColorVec4(ImGuiCol_ButtonActive));
+					else if (is_marked)
+						igPushStyleColor_Vec4(ImGuiCol_Button, *igGetStyleColorVec4(ImGuiCol_HeaderActive));
+
+					// Ctrl+click adds to the selection deleted together
+					if (tile_image_button("##tile", &data->tilemap, i, item_size))
+					{
+						if (igGetIO()->KeyCtrl)
+						{
+							selection->items[i] = !selection->items[i];
+						}
+						else
+						{
+							data->current_texture = i;
+							clear_texture_selection(data);
+						}
+					}
+
+					// Context menu
+					if (igBeginPopupContextItem("context", ImGuiPopupFlags_MouseButtonRight))
+					{
+						if (is_marked && selected_count > 1)
+						{
+							if (igMenuItem_Bool(TextFormat("Delete %zu selected", selected_count), NULL, false, true))
+								remove_selection = true;
+						}
+						else if (igMenuItem_Bool("Delete", NULL, false, true))
+							to_remove = i;
+
+						long tileset = get_texture_tileset(&data->tilemap, i);
+						if (tileset >= 0 && igMenuItem_Bool(TextFormat("Remove tileset %s", data->tilemap.tilesets.items[tileset].name), NULL, false, true))
+							tileset_to_remove = tileset;
+
+						igEndPopup();
+					}
+
+					if (is_selected || is_marked)
+						igPopStyleColor(1);
+
+					igPopID();
+				}
+			}
 		}
-
-		if (is_selected)
-			igPopStyleColor(1);
+		ImGuiListClipper_End(clipper);
 	}
+	ImGuiListClipper_destroy(clipper);
+
+	if (selected_count > 0 && igIsWindowFocused(ImGuiFocusedFlags_None) && IsKeyPressed(KEY_DELETE))
+		remove_selection = true;
 
 	// Button for adding tilesets
 	igSpacing();
@@ -168,14 +816,15 @@ void tile_selector_window(CoreData* data)
 	igSpacing();
 
 	static char file_buffer[IMGUI_BUFFER_SIZE];
-	if (igButtonEx("Add tileset", (ImVec2){window_size.x - spacing.x * 2.0f, 20.0f}, ImGuiButtonFlags_None) && !data->show_add_tileset_popup)
+	if (igButtonEx("Add tileset", (ImVec2){window_size.x - spacing.x * 2.0f, 20.0f}, ImGuiButtonFlags_None) && !data->show_add_tileset_popup && !data->load.running)
 	{
 		data->show_add_tileset_popup = true;
-		file_buffer[0] = '\0';
+		data->import_failed = false;
+		if (!data->import.running)
+			file_buffer[0] = '\0';
 	}
 
 	// Add tileset popup window
-	// TODO: add filter
 	if (data->show_add_tileset_popup)
 	{
 		ImGuiIO* io = igGetIO();
@@ -194,6 +843,14 @@ void tile_selector_window(CoreData* data)
 		static int tiles_number[2];
 		igInputInt2("Number of tiles", tiles_number, ImGuiInputTextFlags_None);
 		
+		// The tiles are added by finish_import, which closes the popup
+		bool importing = data->import.running;
+		if (importing)
+			igProgressBar(async_import_progress(&data->import), (ImVec2){-FLT_MIN, 0.0f}, "Importing...");
+		else if (data->import_failed)
+			igTextColored((ImVec4){1.0f, 0.3f, 0.3f, 1.0f}, "Could not import the tileset");
+
+		igBeginDisabled(importing);
 		if (igButton("Cancel", (ImVec2){0.0f, 0.0f}))
 			data->show_add_tileset_popup = false;
 
@@ -203,37 +860,255 @@ void tile_selector_window(CoreData* data)
 		
 		if (igButton("Done", (ImVec2){0.0f, 0.0f}))
 		{
-			add_tileset(&data->tilemap, file_buffer, tiles_number[0], tiles_number[1]);
-			data->show_add_tileset_popup = false;
+			data->import_failed = false;
+			async_import_start(&data->import, file_buffer, tiles_number[0], tiles_number[1]);
 		}
+		igEndDisabled();
 
 		igEnd();
 	}
 
 	igEnd(); // Tile selector
 
+	// The history refers to textures by index
 	if (to_remove >= 0 && to_remove < data->tilemap.textures.size)
+	{
 		remove_texture(&data->tilemap, to_remove);
+		history_clear(&data->history);
+		clear_texture_selection(data);
+	}
+
+	if (remove_selection)
+	{
+		Indices indices = {0};
+		for (size_t i = 0; i < selection->size; i++)
+		{
+			if (selection->items[i])
+				da_append(indices, i);
+		}
+
+		remove_textures(&data->tilemap, indices.items, indices.size);
+		history_clear(&data->history);
+		clear_texture_selection(data);
+		free(indices.items);
+	}
+
+	if (tileset_to_remove >= 0)
+	{
+		remove_tileset(&data->tilemap, tileset_to_remove);
+		history_clear(&data->history);
+		clear_texture_selection(data);
+	}
+}
+
+void tools_window(CoreData* data)
+{
+	igBegin("Tools", NULL, ImGuiWindowFlags_None);
+
+	int tool = data->tool;
+	igRadioButton_IntPtr("Brush", &tool, TOOL_BRUSH);
+	igSameLine(0, -1);
+	igRadioButton_IntPtr("Fill", &tool, TOOL_FILL);
+	igSameLine(0, -1);
+	igRadioButton_IntPtr("Rectangle", &tool, TOOL_RECTANGLE);
+	if (tool != (int)data->tool)
+	{
+		data->tool = tool;
+		data->tool_status = NULL;
+		data->rectangle_dragging = false;
+	}
+
+	igSeparator();
+
+	if (data->tool == TOOL_BRUSH)
+	{
+		int shape = data->brush.shape;
+		igRadioButton_IntPtr("Square", &shape, BRUSH_SQUARE);
+		igSameLine(0, -1);
+		igRadioButton_IntPtr("Circle", &shape, BRUSH_CIRCLE);
+		data->brush.shape = shape;
+
+		igSliderInt("Brush size", &data->brush.size, 1, BRUSH_MAX_SIZE, "%d", ImGuiSliderFlags_AlwaysClamp);
+	}
+	else
+	{
+		igSliderInt("Fill limit", &data->fill_max_cells, 1, FILL_MAX_CELLS_LIMIT, "%d cells", ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_Logarithmic);
+	}
+
+	if (data->tool_status)
+		igTextDisabled("%s", data->tool_status);
+
+	igEnd();
+}
+
+void profile_summary_row(const char* name, ProfileSummary summary, const char* format)
+{
+	igTableNextRow(ImGuiTableRowFlags_None, 0.0f);
+	igTableSetColumnIndex(0);
+	igTextUnformatted(name, NULL);
+	igTableSetColumnIndex(1);
+	igText(format, summary.last);
+	igTableSetColumnIndex(2);
+	igText(format, summary.average);
+	igTableSetColumnIndex(3);
+	igText(format, summary.max);
+}
+
+bool begin_profile_table(const char* id, const char* first_column)
+{
+	if (!igBeginTable(id, 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV, (ImVec2){0, 0}, 0.0f))
+		return false;
+
+	igTableSetupColumn(first_column, ImGuiTableColumnFlags_WidthStretch, 0.0f, 0);
+	igTableSetupColumn("Last", ImGuiTableColumnFlags_WidthFixed, 70.0f, 0);
+	igTableSetupColumn("Average", ImGuiTableColumnFlags_WidthFixed, 70.0f, 0);
+	igTableSetupColumn("Max", ImGuiTableColumnFlags_WidthFixed, 70.0f, 0);
+	igTableHeadersRow();
+
+	return true;
+}
+
+// Returns whether the profiler is shown, timings are only taken then
+bool profiler_window(CoreData* data)
+{
+	if (!data->show_profiler)
+		return false;
+
+	igSetNextWindowSize((ImVec2){ 420.0f, 520.0f }, ImGuiCond_FirstUseEver);
+	if (!igBegin("Profiler", &data->show_profiler, ImGuiWindowFlags_None))
+	{
+		igEnd();
+		return false;
+	}
+
+	const Profiler* profiler = &data->profiler;
+	int start = profiler_history_start(profiler);
+	int size = profiler_history_size(profiler);
+	char overlay[IMGUI_BUFFER_SIZE];
+
+	ProfileSummary frame = summarize_profile_history(profiler, profiler->frame_history);
+	snprintf(overlay, sizeof(overlay), "%.2f ms (%.0f fps)", frame.average, frame.average > 0.0f ? 1000.0f / frame.average : 0.0f);
+	igPlotLines_FloatPtr("##Frame", profiler->frame_history, size, start, overlay, 0.0f, frame.max * 1.2f, (ImVec2){ -FLT_MIN, 80.0f }, sizeof(float));
+
+	// Time outside every stage: the rest of the ImGui frame, buffer swap and waiting for the next frame
+	float other[PROFILER_FRAMES];
+	for (int i = 0; i < size; i++)
+	{
+		other[i] = profiler->frame_history[i];
+		for (int j = 0; j < PROFILE_STAGE_COUNT; j++)
+			other[i] -= profiler->stage_history[j][i];
+	}
+
+	if (begin_profile_table("Stages", "Stage (ms)"))
+	{
+		for (int i = 0; i < PROFILE_STAGE_COUNT; i++)
+			profile_summary_row(get_profile_stage_name(i), summarize_profile_history(profiler, profiler->stage_history[i]), "%.3f");
+		profile_summary_row("Other", summarize_profile_history(profiler, other), "%.3f");
+		profile_summary_row("Frame", frame, "%.3f");
+		igEndTable();
+	}
+
+	if (begin_profile_table("Counters", "Counter"))
+	{
+		for (int i = 0; i < PROFILE_COUNTER_COUNT; i++)
+			profile_summary_row(get_profile_counter_name(i), summarize_profile_history(profiler, profiler->counter_history[i]), "%.0f");
+		igEndTable();
+	}
+
+	if (igCollapsingHeader_TreeNodeFlags("Stage graphs", ImGuiTreeNodeFlags_None))
+	{
+		for (int i = 0; i < PROFILE_STAGE_COUNT; i++)
+		{
+			ProfileSummary summary = summarize_profile_history(profiler, profiler->stage_history[i]);
+			snprintf(overlay, sizeof(overlay), "%s %.3f ms", get_profile_stage_name(i), summary.average);
+			igPushID_Int(i);
+			igPlotLines_FloatPtr("##Stage", profiler->stage_history[i], size, start, overlay, 0.0f, summary.max * 1.2f + 0.001f, (ImVec2){ -FLT_MIN, 40.0f }, sizeof(float));
+			igPopID();
+		}
+	}
+
+	igEnd();
+	return true;
+}
+
+void set_save_status(CoreData* data, const char* status)
+{
+	data->save_status = status;
+	data->save_status_time = GetTime();
+}
+
+void finish_save(CoreData* data, bool success)
+{
+	int profile = profile_begin(&data->profiler, PROFILE_IO);
+	if (success)
+	{
+		// Records written during the save stay in the journal, unless edits were made without recording them
+		bool complete = data->saving_with_journal || get_tilemap_revision(&data->tilemap) == data->saving_tilemap_revision;
+		uint64_t base_revision = complete ? data->saving_revision : UINT64_MAX;
+		journal_compact(&data->journal, data->saving_journal_offset, data->saving_filepath, base_revision);
+	}
+	else
+	{
+		// The journal may hold records the tilemap file doesn't match, the next save must be full
+		data->journal.base_revision = UINT64_MAX;
+	}
+
+	free(data->saving_filepath);
+	data->saving_filepath = NULL;
+	set_save_status(data, success ? "Saved" : "Save failed");
+	profile_end(&data->profiler, profile);
+}
+
+void wait_for_save(CoreData* data)
+{
+	if (data->save.running)
+		finish_save(data, async_save_wait(&data->save));
 }
 
 void new_tilemap(CoreData* data)
 {
+	wait_for_save(data);
+	journal_close(&data->journal);
+
 	unload_tilemap(&data->tilemap);
+	history_clear(&data->history);
 	if (data->tilemap_filepath)
 		free(data->tilemap_filepath);
 
 	data->tilemap_filepath = NULL;
+	data->viewport_dirty = true;
+	data->palette.dirty = true;
 	data->camera.zoom = 100.0f;
 	data->camera.target = Vector2Zero(); 
 	data->current_texture = 0;
 }
 
+// Writes the whole tilemap in the background, then compacts the journal
+void start_save(CoreData* data, const char* filepath)
+{
+	wait_for_save(data);
+	data->save_status = NULL;
+
+	int profile = profile_begin(&data->profiler, PROFILE_IO);
+	journal_flush(&data->journal, false);
+	data->saving_filepath = strdup(filepath);
+	data->saving_journal_offset = data->journal.size;
+	data->saving_revision = get_tilemap_structure_revision(&data->tilemap);
+	data->saving_tilemap_revision = get_tilemap_revision(&data->tilemap);
+	data->saving_with_journal = journal_accepts(&data->journal, &data->tilemap);
+
+	bool started = async_save_start(&data->save, &data->tilemap, filepath);
+	if (!data->save.running)
+		finish_save(data, started);
+	profile_end(&data->profiler, profile);
+}
+
 void save_tilemap_as(CoreData* data)
 {
 	char* file = open_dialog(false);
 	if (file)
 	{
-		save_tilemap(&data->tilemap, file);
+		start_save(data, file);
 		if (data->tilemap_filepath)
 			free(data->tilemap_filepath);
 		data->tilemap_filepath = file;
@@ -242,10 +1117,21 @@ void save_tilemap_as(CoreData* data)
 
 void save_tilemap_to_file(CoreData* data)
 {
-	if (data->tilemap_filepath)
-		save_tilemap(&data->tilemap, data->tilemap_filepath);
-	else
+	if (!data->tilemap_filepath)
+	{
 		save_tilemap_as(data);
+		return;
+	}
+
+	// Only grid edits since the last full save, they are all in the journal
+	if (journal_accepts(&data->journal, &data->tilemap) && data->journal.size < JOURNAL_COMPACT_SIZE)
+	{
+		int profile = profile_begin(&data->profiler, PROFILE_IO);
+		set_save_status(data, journal_flush(&data->journal, true) ? "Saved" : "Save failed");
+		profile_end(&data->profiler, profile);
+	}
+	else
+		start_save(data, data->tilemap_filepath);
 }
 
 void open_tilemap_from_file(CoreData* data)
@@ -253,17 +1139,78 @@ void open_tilemap_from_file(CoreData* data)
 	char* file = open_dialog(false);
 	if (file)
 	{
+		wait_for_save(data);
+		journal_close(&data->journal);
+
+		// The viewport shows an empty map until finish_load
 		unload_tilemap(&data->tilemap);
-		data->tilemap = load_tilemap(file);
+		history_clear(&data->history);
+		clear_texture_selection(data);
+		data->viewport_dirty = true;
+		data->palette.dirty = true;
 
 		if (data->tilemap_filepath)
 			free(data->tilemap_filepath);
-		data->tilemap_filepath = file;
+		data->tilemap_filepath = NULL;
+
+		if (async_load_start(&data->load, file))
+			data->tilemap_filepath = file;
+		else
+			free(file);
 	}
 }
 
-int main(void)
+void finish_load(CoreData* data, Tilemap tilemap, bool success)
 {
+	int profile = profile_begin(&data->profiler, PROFILE_IO);
+	unload_tilemap(&data->tilemap);
+	data->tilemap = tilemap;
+	data->viewport_dirty = true;
+	data->palette.dirty = true;
+
+	if (success)
+		journal_open(&data->journal, data->tilemap_filepath, get_tilemap_structure_revision(&data->tilemap));
+	else
+	{
+		// Saving would replace the file that could not be read
+		free(data->tilemap_filepath);
+		data->tilemap_filepath = NULL;
+		set_save_status(data, "Could not open the file");
+	}
+	profile_end(&data->profiler, profile);
+}
+
+void finish_import(CoreData* data, TilesetImport* import, bool success)
+{
+	int profile = profile_begin(&data->profiler, PROFILE_IO);
+	// New textures go after the existing ones, the history and the selection stay valid
+	if (success && add_tileset_import(&data->tilemap, import))
+		data->show_add_tileset_popup = false;
+	else
+	{
+		// The popup stays open to fix the path or the number of tiles
+		unload_tileset_import(import);
+		data->import_failed = true;
+		if (!data->show_add_tileset_popup)
+			set_save_status(data, "Could not import the tileset");
+	}
+	profile_end(&data->profiler, profile);
+}
+
+// Tracing is on with --trace <file> or the TILEMAP_TRACE environment variable,
+// the trace is written on exit and from the View menu
+int main(int argc, char** argv)
+{
+	const char* trace_filepath = getenv(TRACE_ENV);
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			trace_filepath = argv[++i];
+		else
+			fprintf(stderr, "WARNING: Unknown argument \"%s\"\n", argv[i]);
+	}
+	trace_init(trace_filepath);
+
 	SetConfigFlags(FLAG_WINDOW_RESIZABLE);
 	InitWindow(800, 600, "Tilemap editor");
 	SetTargetFPS(60);
@@ -277,6 +1224,8 @@ int main(void)
 	CoreData data =
 	{
 		.viewport = LoadRenderTexture(800, 480),
+		.brush = { .shape = BRUSH_SQUARE, .size = 1 },
+		.fill_max_cells = FILL_DEFAULT_MAX_CELLS,
 	};
 
 	new_tilemap(&data);
@@ -285,9 +1234,13 @@ int main(void)
 
 	while (!WindowShouldClose())
 	{
-		bool mouse_in_viewport = CheckCollisionPointRec(GetMousePosition(), data.viewport_bounds) && !data.show_add_tileset_popup;
+		TRACE_BEGIN("frame");
+		int input_profile = profile_begin(&data.profiler, PROFILE_INPUT);
+
+		bool mouse_in_viewport = CheckCollisionPointRec(GetMousePosition(), data.viewport_bounds) && !data.show_add_tileset_popup && !data.load.running;
 		bool control = IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
 		bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+		bool alt = IsKeyDown(KEY_LEFT_ALT) || IsKeyDown(KEY_RIGHT_ALT);
 
 		float dt = GetFrameTime();
 
@@ -318,50 +1271,89 @@ int main(void)
 				data.camera.target = mouse_pos_2d;
 
 				data.camera.zoom += mouse_wheel * data.camera.zoom * dt * CAMERA_ZOOM_FACTOR;
-				if (data.camera.zoom <= 1.0f)
-					data.camera.zoom = 1.0f;
+				if (data.camera.zoom <= CAMERA_MIN_ZOOM)
+					data.camera.zoom = CAMERA_MIN_ZOOM;
 			}
 		}
 
-		if (mouse_in_viewport && IsMouseButtonDown(MOUSE_BUTTON_LEFT) && data.tilemap.textures.size > 0)
+		// Alt places and removes free tiles instead of grid tiles
+		if (mouse_in_viewport && alt && IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && data.tilemap.textures.size > 0)
 		{
-			int collision_index = get_tile_index_collides_with_mouse(&data, &data.tilemap.main_layer);
-			if (collision_index >= 0)
+			Vector2 mouse_pos = get_mouse_pos_in_layer(&data, &data.tilemap.main_layer);
+			Tile tile =
 			{
-				if (data.tilemap.main_layer.tiles.items[collision_index].texture_index != data.current_texture)
-				{
-					da_remove_at(data.tilemap.main_layer.tiles, collision_index);
-					collision_index = -1;
-				}
-			}
+				.bounds = { mouse_pos.x - 0.5f, mouse_pos.y - 0.5f, 1.0f, 1.0f },
+				.texture_index = data.current_texture,
+				.tint = WHITE,
+			};
 
-			if (collision_index < 0)
-			{
-				Vector2 mouse_pos = get_mouse_pos_in_2d_world(&data); 
-				Tile tile =
-				{
-					.tilemap_index = { mouse_pos.x, mouse_pos.y },
-					.texture_index = data.current_texture,
-					.tint = WHITE,
-				};
+			place_static_tile(&data, &data.tilemap.main_layer, tile);
+		}
 
-				if (mouse_pos.x < 0)
-					tile.tilemap_index.x -= 1;
-				if (mouse_pos.y < 0)
-					tile.tilemap_index.y -= 1;
+		if (mouse_in_viewport && alt && IsMouseButtonPressed(MOUSE_BUTTON_RIGHT))
+		{
+			int profile = profile_begin(&data.profiler, PROFILE_PICKING);
+			Vector2 mouse_pos = get_mouse_pos_in_layer(&data, &data.tilemap.main_layer);
+			long static_index = pick_static_tile(&data.tilemap.main_layer, mouse_pos);
+			profile_end(&data.profiler, profile);
+			if (static_index >= 0)
+				erase_static_tile(&data, &data.tilemap.main_layer, static_index);
+		}
 
-				da_append(data.tilemap.main_layer.tiles, tile);
-			}
+		CellValue current_value = { .texture_index = data.current_texture, .tint = WHITE };
+		bool can_paint = data.tilemap.textures.size > 0;
+
+		bool paint = data.tool == TOOL_BRUSH && mouse_in_viewport && !alt && IsMouseButtonDown(MOUSE_BUTTON_LEFT) && can_paint;
+		bool erase = data.tool == TOOL_BRUSH && mouse_in_viewport && !alt && IsMouseButtonDown(MOUSE_BUTTON_RIGHT);
+		if (paint || erase)
+		{
+			Vec2i tile_index = get_tile_index_under_mouse(&data, &data.tilemap.main_layer);
+			Vec2i from = data.painting ? data.last_paint_cell : tile_index;
+
+			data.stroke_cells.size = 0;
+			brush_line(data.brush, from, tile_index, &data.stroke_cells);
+			sort_cells(&data.stroke_cells);
+
+			paint_cells(&data, &data.tilemap.main_layer, &data.stroke_cells, paint ? current_value : get_cell_value(NULL));
+
+			data.painting = true;
+			data.last_paint_cell = tile_index;
+		}
+		else
+			data.painting = false;
+
+		// Right click fills with nothing, erasing
+		if (data.tool == TOOL_FILL && mouse_in_viewport && !alt)
+		{
+			Vec2i tile_index = get_tile_index_under_mouse(&data, &data.tilemap.main_layer);
+			if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && can_paint)
+				fill_region(&data, &data.tilemap.main_layer, tile_index, current_value);
+			else if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT))
+				fill_region(&data, &data.tilemap.main_layer, tile_index, get_cell_value(NULL));
 		}
 
-		if (mouse_in_viewport && IsMouseButtonDown(MOUSE_BUTTON_RIGHT))
+		if (data.tool == TOOL_RECTANGLE)
 		{
-			int collision_index = get_tile_index_collides_with_mouse(&data, &data.tilemap.main_layer);
-			if (collision_index >= 0)
-				da_remove_at(data.tilemap.main_layer.tiles, collision_index);
+			if (!data.rectangle_dragging && mouse_in_viewport && !alt)
+			{
+				data.rectangle_erases = IsMouseButtonPressed(MOUSE_BUTTON_RIGHT);
+				data.rectangle_dragging = (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && can_paint) || data.rectangle_erases;
+				data.rectangle_start = get_tile_index_under_mouse(&data, &data.tilemap.main_layer);
+			}
+			else if (data.rectangle_dragging && IsMouseButtonReleased(data.rectangle_erases ? MOUSE_BUTTON_RIGHT : MOUSE_BUTTON_LEFT))
+			{
+				Vec2i tile_index = get_tile_index_under_mouse(&data, &data.tilemap.main_layer);
+				fill_area(&data, &data.tilemap.main_layer, data.rectangle_start, tile_index,
+					data.rectangle_erases ? get_cell_value(NULL) : current_value);
+				data.rectangle_dragging = false;
+			}
 		}
 
-		bool allow_input = !data.show_add_tileset_popup;
+		// A drag is one undo step
+		if (!IsMouseButtonDown(MOUSE_BUTTON_LEFT) && !IsMouseButtonDown(MOUSE_BUTTON_RIGHT))
+			history_end_stroke(&data.history);
+
+		bool allow_input = !data.show_add_tileset_popup && !data.load.running;
 		if (allow_input)
 		{
 			if (IsKeyPressedRepeat(KEY_LEFT) || IsKeyPressed(KEY_LEFT))
@@ -394,8 +1386,43 @@ int main(void)
 			}
 			if (IsKeyPressed(KEY_O))
 				open_tilemap_from_file(&data);
+			if (IsKeyPressed(KEY_Z) || IsKeyPressedRepeat(KEY_Z))
+			{
+				if (shift)
+					redo(&data);
+				else
+					undo(&data);
+			}
+			if (IsKeyPressed(KEY_Y) || IsKeyPressedRepeat(KEY_Y))
+				redo(&data);
 		}
 
+		profile_end(&data.profiler, input_profile);
+
+		// Edits of this frame go to disk, a crash loses at most the last frames
+		int io_profile = profile_begin(&data.profiler, PROFILE_IO);
+		Tilemap loaded;
+		bool load_succeeded;
+		if (async_load_poll(&data.load, &loaded, &load_succeeded))
+			finish_load(&data, loaded, load_succeeded);
+
+		// Held back while a file opens, the tileset goes to the opened tilemap
+		TilesetImport imported;
+		bool import_succeeded;
+		if (!data.load.running && async_import_poll(&data.import, &imported, &import_succeeded))
+			finish_import(&data, &imported, import_succeeded);
+
+		journal_flush(&data.journal, false);
+		if (!data.save.running && data.tilemap_filepath && journal_accepts(&data.journal, &data.tilemap) &&
+			data.journal.size >= JOURNAL_COMPACT_SIZE)
+			start_save(&data, data.tilemap_filepath);
+		profile_end(&data.profiler, io_profile);
+
+		// Upload the tiles added since the last frame
+		int upload_profile = profile_begin(&data.profiler, PROFILE_TEXTURE_UPLOAD);
+		data.pending_uploads = atlas_update(&data.tilemap.atlas, ATLAS_UPLOADS_PER_FRAME);
+		profile_end(&data.profiler, upload_profile);
+
 		BeginDrawing();
 		ClearBackground(WHITE);
 
@@ -406,20 +1433,60 @@ int main(void)
 		// Menu bar
 		if (igBeginMainMenuBar())
 		{
+			bool loading = data.load.running;
 			if (igBeginMenu("File", true))
 			{
-				if (igMenuItem_Bool("New", "ctrl+n", false, true))
+				if (igMenuItem_Bool("New", "ctrl+n", false, !loading))
 					new_tilemap(&data);
-				if (igMenuItem_Bool("Save", "ctrl+s", false, true))
+				if (igMenuItem_Bool("Save", "ctrl+s", false, !loading))
 					save_tilemap_to_file(&data);
-				if (igMenuItem_Bool("Save as", "ctrl+shift+s", false, true))
+				if (igMenuItem_Bool("Save as", "ctrl+shift+s", false, !loading))
 					save_tilemap_as(&data);
-				if (igMenuItem_Bool("Open", "ctrl+o", false, true))
+				if (igMenuItem_Bool("Open", "ctrl+o", false, !loading))
 					open_tilemap_from_file(&data);
 
 				igEndMenu();
 			}
 
+			if (igBeginMenu("Edit", true))
+			{
+				if (igMenuItem_Bool("Undo", "ctrl+z", false, !loading && (data.history.current > 0 || data.history.recording)))
+					undo(&data);
+				if (igMenuItem_Bool("Redo", "ctrl+y", false, !loading && data.history.current < data.history.size))
+					redo(&data);
+
+				igSeparator();
+
+				int memory_mb = (int)((data.history.memory_limit ? data.history.memory_limit : HISTORY_DEFAULT_MEMORY_LIMIT) / (1024 * 1024));
+				if (igSliderInt("History memory", &memory_mb, HISTORY_MIN_MEMORY_MB, HISTORY_MAX_MEMORY_MB, "%d MB", ImGuiSliderFlags_AlwaysClamp))
+					history_set_memory_limit(&data.history, (size_t)memory_mb * 1024 * 1024);
+				igTextDisabled("%.1f MB used", data.history.memory / (1024.0 * 1024.0));
+
+				igEndMenu();
+			}
+
+			if (igBeginMenu("View", true))
+			{
+				igMenuItem_BoolPtr("Profiler", NULL, &data.show_profiler, true);
+				if (igMenuItem_Bool("Write trace", NULL, false, trace_enabled))
+					set_save_status(&data, trace_write() ? "Trace written" : "Could not write the trace");
+				igEndMenu();
+			}
+
+			bool saved;
+			if (async_save_poll(&data.save, &saved))
+				finish_save(&data, saved);
+
+			if (loading)
+				igTextDisabled("Opening %s...", GetFileName(data.tilemap_filepath));
+			else if (data.pending_uploads > 0)
+				igTextDisabled("Uploading textures, %zu pages left", data.pending_uploads);
+
+			if (data.save.running)
+				igProgressBar(async_save_progress(&data.save), (ImVec2){150.0f, 0.0f}, "Saving...");
+			else if (data.save_status && GetTime() - data.save_status_time < SAVE_STATUS_DURATION)
+				igTextDisabled("%s", data.save_status);
+
 			igEndMainMenuBar();
 		}
 
@@ -433,15 +1500,50 @@ int main(void)
 		viewport_window(&data);
 
 		// Tile selector
+		int selector_profile = profile_begin(&data.profiler, PROFILE_TILE_SELECTOR);
 		tile_selector_window(&data);
+		profile_end(&data.profiler, selector_profile);
+
+		tools_window(&data);
+
+		bool profiling = profiler_window(&data);
 
 		// end ImGui Content
+		int render_profile = profile_begin(&data.profiler, PROFILE_IMGUI_RENDER);
 		rlImGuiEnd();
+		profile_end(&data.profiler, render_profile);
 
 		EndDrawing();
+
+		TileRendererStats* stats = &data.renderer.stats;
+		profile_count(&data.profiler, PROFILE_TILES_DRAWN, stats->tiles_drawn);
+		profile_count(&data.profiler, PROFILE_DRAW_CALLS, stats->draw_calls);
+		profile_count(&data.profiler, PROFILE_TEXTURE_BINDS, stats->texture_binds);
+		*stats = (TileRendererStats){0};
+
+		profiler_end_frame(&data.profiler, profiling);
+		TRACE_END();
 	}
 	
+	// Don't lose a save started right before closing
+	wait_for_save(&data);
+	Tilemap loaded;
+	if (async_load_wait(&data.load, &loaded, NULL))
+		unload_tilemap(&loaded);
+	TilesetImport imported;
+	if (async_import_wait(&data.import, &imported, NULL))
+		unload_tileset_import(&imported);
+	journal_close(&data.journal);
+	if (trace_enabled)
+		trace_write();
+	history_free(&data.history);
+	free(data.stroke_cells.items);
+	free(data.fill_changes.items);
+	free(data.selected_textures.items);
+	unload_palette(&data.palette);
+
 	unload_tileset(&data.tilemap);
+	tile_renderer_unload(&data.renderer);
 	UnloadRenderTexture(data.viewport);
 	
 	rlImGuiShutdown();
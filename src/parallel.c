@@ -0,0 +1,151 @@
+#include "parallel.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+typedef struct
+{
+	ParallelJob job;
+	void* context;
+	size_t count;
+	atomic_size_t next;
+} ParallelWork;
+
+int get_thread_count(void)
+{
+	long result = sysconf(_SC_NPROCESSORS_ONLN);
+	if (result < 1)
+		return 1;
+	if (result > PARALLEL_MAX_THREADS)
+		return PARALLEL_MAX_THREADS;
+
+	return (int)result;
+}
+
+// Every thread takes the next index until there is none left, so uneven jobs balance out
+static void* run_worker(void* argument)
+{
+	ParallelWork* work = argument;
+	TRACE_BEGIN("parallel_for");
+	while (true)
+	{
+		size_t index = atomic_fetch_add(&work->next, 1);
+		if (index >= work->count)
+			break;
+
+		work->job(work->context, index);
+	}
+	TRACE_END();
+
+	return NULL;
+}
+
+// Workers started once and kept for the whole run, they sleep between batches
+typedef struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t wake; // Signaled when a batch is posted
+	pthread_cond_t done; // Signaled when the last worker leaves the batch
+	ParallelWork* work;
+	uint64_t generation; // Incremented for every batch
+	size_t busy; // Workers still in the current batch
+	size_t worker_count;
+	atomic_bool taken; // A thread is running a batch on the pool
+} ThreadPool;
+
+static ThreadPool pool =
+{
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+// Set for good on the workers, and on a caller during its batch
+static _Thread_local bool inside_parallel_for;
+
+static void* run_pool_worker(void* argument)
+{
+	(void)argument;
+	inside_parallel_for = true;
+
+	// Every worker takes part in every batch, the next one is only posted once they all left
+	uint64_t generation = 0;
+	pthread_mutex_lock(&pool.mutex);
+	while (true)
+	{
+		while (pool.generation == generation)
+			pthread_cond_wait(&pool.wake, &pool.mutex);
+		generation = pool.generation;
+		ParallelWork* work = pool.work;
+		pthread_mutex_unlock(&pool.mutex);
+
+		run_worker(work);
+
+		pthread_mutex_lock(&pool.mutex);
+		if (--pool.busy == 0)
+			pthread_cond_signal(&pool.done);
+	}
+
+	return NULL;
+}
+
+static void start_pool(void)
+{
+	int thread_count = get_thread_count();
+	for (int i = 1; i < thread_count; i++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, run_pool_worker, NULL) != 0)
+		{
+			fprintf(stderr, "WARNING: Could not start a worker thread, continuing with %zu\n", pool.worker_count + 1);
+			break;
+		}
+		pthread_detach(thread);
+		pool.worker_count++;
+	}
+}
+
+void parallel_for(size_t count, ParallelJob job, void* context)
+{
+	if (count == 0 || !job)
+		return;
+
+	ParallelWork work = { .job = job, .context = context, .count = count };
+	atomic_init(&work.next, 0);
+
+	pthread_once(&pool_once, start_pool);
+
+	// Nested in a job, or while the pool works for another thread, the calling thread does it all
+	bool taken = false;
+	if (count == 1 || inside_parallel_for || pool.worker_count == 0 ||
+		!atomic_compare_exchange_strong(&pool.taken, &taken, true))
+	{
+		run_worker(&work);
+		return;
+	}
+	inside_parallel_for = true;
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.work = &work;
+	pool.busy = pool.worker_count;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.mutex);
+
+	run_worker(&work);
+
+	// work lives on this stack, the workers must be done with it
+	pthread_mutex_lock(&pool.mutex);
+	while (pool.busy > 0)
+		pthread_cond_wait(&pool.done, &pool.mutex);
+	pthread_mutex_unlock(&pool.mutex);
+
+	inside_parallel_for = false;
+	atomic_store(&pool.taken, false);
+}
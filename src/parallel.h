@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+
+// Upper bound on the threads used by parallel_for, including the calling thread
+#define PARALLEL_MAX_THREADS 16
+
+typedef void (*ParallelJob)(void* context, size_t index);
+
+// Number of threads parallel_for uses for large enough counts
+int get_thread_count(void);
+
+// Calls job(context, i) for every i in [0, count) from up to get_thread_count() threads,
+// returns once every call has finished. Jobs may run in any order.
+// The threads are a pool started by the first call. Calls made from a job, or while the pool
+// works for another thread, run every job on the calling thread.
+void parallel_for(size_t count, ParallelJob job, void* context);
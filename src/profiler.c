@@ -0,0 +1,134 @@
+#include "profiler.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+static const char* stage_names[PROFILE_STAGE_COUNT] =
+{
+	[PROFILE_INPUT] = "Input",
+	[PROFILE_PICKING] = "Picking",
+	[PROFILE_DRAW_VIEWPORT] = "Draw viewport",
+	[PROFILE_TILE_SELECTOR] = "Tile selector",
+	[PROFILE_IMGUI_RENDER] = "ImGui render",
+	[PROFILE_TEXTURE_UPLOAD] = "Texture upload",
+	[PROFILE_IO] = "I/O",
+};
+
+static const char* counter_names[PROFILE_COUNTER_COUNT] =
+{
+	[PROFILE_TILES_DRAWN] = "Tiles drawn",
+	[PROFILE_DRAW_CALLS] = "Draw calls",
+	[PROFILE_TEXTURE_BINDS] = "Texture binds",
+};
+
+static double get_time(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+const char* get_profile_stage_name(ProfileStage stage)
+{
+	return stage_names[stage];
+}
+
+const char* get_profile_counter_name(ProfileCounter counter)
+{
+	return counter_names[counter];
+}
+
+int profile_begin(Profiler* profiler, ProfileStage stage)
+{
+	TRACE_BEGIN(stage_names[stage]);
+	if (!profiler->enabled)
+		return PROFILE_DISABLED;
+
+	double now = get_time();
+	if (profiler->stage >= 0)
+		profiler->stage_times[profiler->stage] += now - profiler->stage_start;
+
+	int previous = profiler->stage;
+	profiler->stage = stage;
+	profiler->stage_start = now;
+
+	return previous;
+}
+
+void profile_end(Profiler* profiler, int previous)
+{
+	TRACE_END();
+	if (previous == PROFILE_DISABLED)
+		return;
+
+	double now = get_time();
+	profiler->stage_times[profiler->stage] += now - profiler->stage_start;
+
+	// Resume the interrupted stage
+	profiler->stage = previous;
+	profiler->stage_start = now;
+}
+
+void profile_count(Profiler* profiler, ProfileCounter counter, uint64_t amount)
+{
+	if (profiler->enabled)
+		profiler->counters[counter] += amount;
+}
+
+void profiler_end_frame(Profiler* profiler, bool enabled)
+{
+	double now = get_time();
+
+	if (profiler->enabled && profiler->frame_start > 0.0)
+	{
+		int frame = profiler->next;
+		profiler->frame_history[frame] = (float)((now - profiler->frame_start) * 1000.0);
+		for (int i = 0; i < PROFILE_STAGE_COUNT; i++)
+			profiler->stage_history[i][frame] = (float)(profiler->stage_times[i] * 1000.0);
+		for (int i = 0; i < PROFILE_COUNTER_COUNT; i++)
+			profiler->counter_history[i][frame] = (float)profiler->counters[i];
+
+		profiler->next = (frame + 1) % PROFILER_FRAMES;
+		if (profiler->frame_count < PROFILER_FRAMES)
+			profiler->frame_count++;
+	}
+
+	memset(profiler->stage_times, 0, sizeof(profiler->stage_times));
+	memset(profiler->counters, 0, sizeof(profiler->counters));
+	profiler->stage = -1;
+	profiler->enabled = enabled;
+	// A frame started while disabled isn't complete, it isn't recorded
+	profiler->frame_start = enabled ? now : 0.0;
+}
+
+int profiler_history_start(const Profiler* profiler)
+{
+	return profiler->frame_count < PROFILER_FRAMES ? 0 : profiler->next;
+}
+
+int profiler_history_size(const Profiler* profiler)
+{
+	return profiler->frame_count;
+}
+
+ProfileSummary summarize_profile_history(const Profiler* profiler, const float* history)
+{
+	ProfileSummary result = {0};
+	if (profiler->frame_count == 0)
+		return result;
+
+	float total = 0.0f;
+	for (int i = 0; i < profiler->frame_count; i++)
+	{
+		total += history[i];
+		if (history[i] > result.max)
+			result.max = history[i];
+	}
+
+	result.average = total / profiler->frame_count;
+	result.last = history[(profiler->next + PROFILER_FRAMES - 1) % PROFILER_FRAMES];
+
+	return result;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Frames kept for the graphs of the profiler window
+#define PROFILER_FRAMES 240
+
+typedef enum
+{
+	PROFILE_INPUT,
+	PROFILE_PICKING,
+	PROFILE_DRAW_VIEWPORT,
+	PROFILE_TILE_SELECTOR,
+	PROFILE_IMGUI_RENDER,
+	PROFILE_TEXTURE_UPLOAD,
+	PROFILE_IO,
+	PROFILE_STAGE_COUNT,
+} ProfileStage;
+
+typedef enum
+{
+	PROFILE_TILES_DRAWN,
+	PROFILE_DRAW_CALLS,
+	PROFILE_TEXTURE_BINDS,
+	PROFILE_COUNTER_COUNT,
+} ProfileCounter;
+
+// Returned by profile_begin when the profiler is disabled
+#define PROFILE_DISABLED (-2)
+
+// Per frame stage timings and counters, kept for the last PROFILER_FRAMES frames.
+// Stages nest: while a stage runs, the stage it interrupted is paused, so stage times never
+// overlap and add up to at most the frame time. Everything is a single branch while disabled.
+// Stages are also trace spans when tracing is on.
+typedef struct
+{
+	bool enabled;
+
+	// Current frame
+	int stage; // Running stage, -1 when none
+	double stage_start;
+	double frame_start;
+	double stage_times[PROFILE_STAGE_COUNT]; // Seconds
+	uint64_t counters[PROFILE_COUNTER_COUNT];
+
+	// Finished frames in ring buffers, the oldest at next once frame_count reached PROFILER_FRAMES
+	float frame_history[PROFILER_FRAMES]; // Milliseconds
+	float stage_history[PROFILE_STAGE_COUNT][PROFILER_FRAMES]; // Milliseconds
+	float counter_history[PROFILE_COUNTER_COUNT][PROFILER_FRAMES];
+	int next;
+	int frame_count;
+} Profiler;
+
+const char* get_profile_stage_name(ProfileStage stage);
+const char* get_profile_counter_name(ProfileCounter counter);
+
+// Times a stage until the matching profile_end, which gets the returned value
+int profile_begin(Profiler* profiler, ProfileStage stage);
+void profile_end(Profiler* profiler, int previous);
+void profile_count(Profiler* profiler, ProfileCounter counter, uint64_t amount);
+
+// Call once per frame: stores the frame in the history and starts the next one.
+// enabled takes effect from the next frame, disabling keeps the history.
+void profiler_end_frame(Profiler* profiler, bool enabled);
+
+typedef struct
+{
+	float last;
+	float average;
+	float max;
+} ProfileSummary;
+
+// Summary of one of the history rings of profiler (frame_history or a row of the others)
+ProfileSummary summarize_profile_history(const Profiler* profiler, const float* history);
+
+// Oldest first index in the history rings, and the number of frames in them
+int profiler_history_start(const Profiler* profiler);
+int profiler_history_size(const Profiler* profiler);
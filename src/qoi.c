@@ -0,0 +1,182 @@
+#include "qoi.h"
+
+#include <string.h>
+
+#define QOI_OP_INDEX 0x00 // 00xxxxxx
+#define QOI_OP_DIFF  0x40 // 01xxxxxx
+#define QOI_OP_LUMA  0x80 // 10xxxxxx
+#define QOI_OP_RUN   0xc0 // 11xxxxxx
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_MASK     0xc0
+
+#define QOI_MAX_RUN 62
+
+typedef struct
+{
+	uint8_t r, g, b, a;
+} Pixel;
+
+static int hash_pixel(Pixel pixel)
+{
+	return (pixel.r * 3 + pixel.g * 5 + pixel.b * 7 + pixel.a * 11) % 64;
+}
+
+static bool pixel_equals(Pixel a, Pixel b)
+{
+	return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+size_t qoi_encode(const uint8_t* pixels, int width, int height, uint8_t* output)
+{
+	Pixel index[64] = {0};
+	Pixel previous = { 0, 0, 0, 255 };
+	size_t count = (size_t)width * (size_t)height;
+	size_t size = 0;
+	int run = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		Pixel pixel;
+		memcpy(&pixel, pixels + i * 4, sizeof(pixel));
+
+		if (pixel_equals(pixel, previous))
+		{
+			run++;
+			if (run == QOI_MAX_RUN)
+			{
+				output[size++] = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+			continue;
+		}
+
+		if (run > 0)
+		{
+			output[size++] = QOI_OP_RUN | (run - 1);
+			run = 0;
+		}
+
+		int hash = hash_pixel(pixel);
+		if (pixel_equals(index[hash], pixel))
+		{
+			output[size++] = QOI_OP_INDEX | hash;
+		}
+		else
+		{
+			index[hash] = pixel;
+
+			if (pixel.a == previous.a)
+			{
+				int8_t dr = (int8_t)(pixel.r - previous.r);
+				int8_t dg = (int8_t)(pixel.g - previous.g);
+				int8_t db = (int8_t)(pixel.b - previous.b);
+				int8_t dr_dg = (int8_t)(dr - dg);
+				int8_t db_dg = (int8_t)(db - dg);
+
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+				{
+					output[size++] = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+				}
+				else if (dr_dg >= -8 && dr_dg <= 7 && dg >= -32 && dg <= 31 && db_dg >= -8 && db_dg <= 7)
+				{
+					output[size++] = QOI_OP_LUMA | (dg + 32);
+					output[size++] = ((dr_dg + 8) << 4) | (db_dg + 8);
+				}
+				else
+				{
+					output[size++] = QOI_OP_RGB;
+					output[size++] = pixel.r;
+					output[size++] = pixel.g;
+					output[size++] = pixel.b;
+				}
+			}
+			else
+			{
+				output[size++] = QOI_OP_RGBA;
+				output[size++] = pixel.r;
+				output[size++] = pixel.g;
+				output[size++] = pixel.b;
+				output[size++] = pixel.a;
+			}
+		}
+
+		previous = pixel;
+	}
+
+	if (run > 0)
+		output[size++] = QOI_OP_RUN | (run - 1);
+
+	return size;
+}
+
+bool qoi_decode(const uint8_t* data, size_t size, int width, int height, uint8_t* pixels)
+{
+	Pixel index[64] = {0};
+	Pixel pixel = { 0, 0, 0, 255 };
+	size_t count = (size_t)width * (size_t)height;
+	size_t position = 0;
+	int run = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (run > 0)
+		{
+			run--;
+		}
+		else
+		{
+			if (position >= size)
+				return false;
+
+			uint8_t op = data[position++];
+			if (op == QOI_OP_RGB)
+			{
+				if (size - position < 3)
+					return false;
+				pixel.r = data[position++];
+				pixel.g = data[position++];
+				pixel.b = data[position++];
+			}
+			else if (op == QOI_OP_RGBA)
+			{
+				if (size - position < 4)
+					return false;
+				pixel.r = data[position++];
+				pixel.g = data[position++];
+				pixel.b = data[position++];
+				pixel.a = data[position++];
+			}
+			else if ((op & QOI_MASK) == QOI_OP_INDEX)
+			{
+				pixel = index[op];
+			}
+			else if ((op & QOI_MASK) == QOI_OP_DIFF)
+			{
+				pixel.r += ((op >> 4) & 0x03) - 2;
+				pixel.g += ((op >> 2) & 0x03) - 2;
+				pixel.b += (op & 0x03) - 2;
+			}
+			else if ((op & QOI_MASK) == QOI_OP_LUMA)
+			{
+				if (position >= size)
+					return false;
+				uint8_t second = data[position++];
+				int dg = (op & 0x3f) - 32;
+				pixel.r += dg - 8 + ((second >> 4) & 0x0f);
+				pixel.g += dg;
+				pixel.b += dg - 8 + (second & 0x0f);
+			}
+			else // QOI_OP_RUN
+			{
+				run = op & 0x3f;
+			}
+
+			index[hash_pixel(pixel)] = pixel;
+		}
+
+		memcpy(pixels + i * 4, &pixel, sizeof(pixel));
+	}
+
+	return true;
+}
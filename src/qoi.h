@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// QOI image encoding (https://qoiformat.org) of R8G8B8A8 pixels, without the QOI file header
+// and end marker: width and height are stored by the caller
+
+// Upper bound of the encoded size of an image
+#define QOI_MAX_SIZE(width, height) ((size_t)(width) * (size_t)(height) * 5)
+
+// Encodes width * height pixels into output (at least QOI_MAX_SIZE bytes), returns the encoded size
+size_t qoi_encode(const uint8_t* pixels, int width, int height, uint8_t* output);
+// Decodes exactly width * height pixels into pixels, returns false if data is malformed or too short
+bool qoi_decode(const uint8_t* data, size_t size, int width, int height, uint8_t* pixels);
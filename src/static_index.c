@@ -0,0 +1,396 @@
+#include "static_index.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <raylib.h>
+
+#include "utils.h"
+
+#define STATIC_INDEX_INIT_CAPACITY 64
+
+typedef struct
+{
+	Vec2i min;
+	Vec2i max; // Inclusive
+} BinRange;
+
+static BinRange get_bin_range(Rectangle area)
+{
+	BinRange result =
+	{
+		.min = { (int)floorf(area.x / STATIC_BIN_SIZE), (int)floorf(area.y / STATIC_BIN_SIZE) },
+		.max = { (int)floorf((area.x + area.width) / STATIC_BIN_SIZE), (int)floorf((area.y + area.height) / STATIC_BIN_SIZE) },
+	};
+
+	return result;
+}
+
+static size_t get_bin_count(BinRange range)
+{
+	return (size_t)(range.max.x - range.min.x + 1) * (size_t)(range.max.y - range.min.y + 1);
+}
+
+static bool is_large_tile(Rectangle bounds)
+{
+	return get_bin_count(get_bin_range(bounds)) > STATIC_MAX_BINS_PER_TILE;
+}
+
+static size_t find_slot(const StaticIndex* index, Vec2i position)
+{
+	size_t mask = index->capacity - 1;
+	size_t slot = hash_vec2i(position) & mask;
+	while (index->items[slot] && !vec2i_equals(index->items[slot]->position, position))
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+static StaticBin* get_bin(const StaticIndex* index, Vec2i position)
+{
+	if (index->size == 0)
+		return NULL;
+
+	return index->items[find_slot(index, position)];
+}
+
+static void grow(StaticIndex* index)
+{
+	size_t capacity = index->capacity == 0 ? STATIC_INDEX_INIT_CAPACITY : index->capacity * 2;
+	StaticBin** items = calloc(capacity, sizeof(StaticBin*));
+	if (!items)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return;
+	}
+
+	StaticBin** old_items = index->items;
+	size_t old_capacity = index->capacity;
+	index->items = items;
+	index->capacity = capacity;
+
+	for (size_t i = 0; i < old_capacity; i++)
+	{
+		if (old_items[i])
+			index->items[find_slot(index, old_items[i]->position)] = old_items[i];
+	}
+
+	free(old_items);
+}
+
+static StaticBin* get_or_add_bin(StaticIndex* index, Vec2i position)
+{
+	StaticBin* bin = get_bin(index, position);
+	if (bin)
+		return bin;
+
+	if ((index->size + 1) * 10 > index->capacity * 7)
+		grow(index);
+	if (index->capacity == 0)
+		return NULL;
+
+	bin = calloc(1, sizeof(StaticBin));
+	if (!bin)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return NULL;
+	}
+	bin->position = position;
+
+	index->items[find_slot(index, position)] = bin;
+	index->size++;
+
+	return bin;
+}
+
+static void remove_bin(StaticIndex* index, Vec2i position)
+{
+	size_t mask = index->capacity - 1;
+	size_t hole = find_slot(index, position);
+	if (!index->items[hole])
+		return;
+
+	free(index->items[hole]->tiles.items);
+	free(index->items[hole]);
+	index->items[hole] = NULL;
+	index->size--;
+
+	// Backward shift deletion, same as the chunk directory
+	size_t slot = hole;
+	while (true)
+	{
+		slot = (slot + 1) & mask;
+		if (!index->items[slot])
+			break;
+
+		size_t home = hash_vec2i(index->items[slot]->position) & mask;
+		bool stays = hole <= slot ? (hole < home && home <= slot) : (hole < home || home <= slot);
+		if (stays)
+			continue;
+
+		index->items[hole] = index->items[slot];
+		index->items[slot] = NULL;
+		hole = slot;
+	}
+}
+
+// Removes the first occurrence of order, the order of the others doesn't matter
+static void remove_order(Indices* orders, size_t order)
+{
+	for (size_t i = 0; i < orders->size; i++)
+	{
+		if (orders->items[i] == order)
+		{
+			da_remove_at(*orders, i);
+			return;
+		}
+	}
+}
+
+static void index_insert(StaticIndex* index, Rectangle bounds, size_t order)
+{
+	if (is_large_tile(bounds))
+	{
+		da_append(index->large_tiles, order);
+		return;
+	}
+
+	BinRange range = get_bin_range(bounds);
+	for (int y = range.min.y; y <= range.max.y; y++)
+	{
+		for (int x = range.min.x; x <= range.max.x; x++)
+		{
+			StaticBin* bin = get_or_add_bin(index, (Vec2i){x, y});
+			if (bin)
+				da_append(bin->tiles, order);
+		}
+	}
+}
+
+// Removes the order key from every bin the tile covers
+static void index_remove(StaticIndex* index, Rectangle bounds, size_t order)
+{
+	if (is_large_tile(bounds))
+	{
+		remove_order(&index->large_tiles, order);
+		return;
+	}
+
+	BinRange range = get_bin_range(bounds);
+	for (int y = range.min.y; y <= range.max.y; y++)
+	{
+		for (int x = range.min.x; x <= range.max.x; x++)
+		{
+			StaticBin* bin = get_bin(index, (Vec2i){x, y});
+			if (!bin)
+				continue;
+
+			remove_order(&bin->tiles, order);
+			if (bin->tiles.size == 0)
+				remove_bin(index, bin->position);
+		}
+	}
+}
+
+// Index in static_tiles of the tile with the order key, the keys are sorted like the tiles
+static size_t get_tile_index(const StaticIndex* index, size_t order)
+{
+	size_t low = 0;
+	size_t high = index->orders.size;
+	while (low < high)
+	{
+		size_t middle = low + (high - low) / 2;
+		if (index->orders.items[middle] < order)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+size_t add_static_tile(Layer* layer, Tile tile)
+{
+	StaticIndex* static_index = &layer->static_index;
+	size_t order = static_index->orders.size > 0 ? static_index->orders.items[static_index->orders.size - 1] + 1 : 0;
+	size_t tile_index = layer->static_tiles.size;
+	da_append(layer->static_tiles, tile);
+	da_append(static_index->orders, order);
+	index_insert(static_index, tile.bounds, order);
+	static_index->revision++;
+
+	return tile_index;
+}
+
+void remove_static_tile(Layer* layer, size_t index)
+{
+	if (index >= layer->static_tiles.size)
+		return;
+
+	// The later tiles keep their order, it is the draw order, and their keys
+	StaticIndex* static_index = &layer->static_index;
+	index_remove(static_index, layer->static_tiles.items[index].bounds, static_index->orders.items[index]);
+	da_remove_at_keep_order(layer->static_tiles, index);
+	da_remove_at_keep_order(static_index->orders, index);
+	static_index->revision++;
+}
+
+void unload_static_index(StaticIndex* index)
+{
+	if (!index)
+		return;
+
+	for (size_t i = 0; i < index->capacity; i++)
+	{
+		if (!index->items[i])
+			continue;
+
+		free(index->items[i]->tiles.items);
+		free(index->items[i]);
+	}
+
+	free(index->items);
+	free(index->orders.items);
+	free(index->large_tiles.items);
+	*index = (StaticIndex){0};
+}
+
+void rebuild_static_index(Layer* layer)
+{
+	uint64_t revision = layer->static_index.revision;
+	unload_static_index(&layer->static_index);
+	da_reserve(layer->static_index.orders, layer->static_tiles.size);
+	for (size_t i = 0; i < layer->static_tiles.size; i++)
+	{
+		layer->static_index.orders.items[layer->static_index.orders.size++] = i;
+		index_insert(&layer->static_index, layer->static_tiles.items[i].bounds, i);
+	}
+	layer->static_index.revision = revision + 1;
+}
+
+static int compare_indices(const void* a, const void* b)
+{
+	size_t left = *(const size_t*)a;
+	size_t right = *(const size_t*)b;
+
+	return (left > right) - (left < right);
+}
+
+static void query_bin(const Layer* layer, const StaticBin* bin, Rectangle area, BinRange area_range, Indices* result)
+{
+	for (size_t i = 0; i < bin->tiles.size; i++)
+	{
+		size_t order = bin->tiles.items[i];
+		Rectangle bounds = layer->static_tiles.items[get_tile_index(&layer->static_index, order)].bounds;
+
+		// A tile is in every bin it covers, only report it from the first bin shared with the area
+		BinRange tile_range = get_bin_range(bounds);
+		int first_x = tile_range.min.x > area_range.min.x ? tile_range.min.x : area_range.min.x;
+		int first_y = tile_range.min.y > area_range.min.y ? tile_range.min.y : area_range.min.y;
+		if (bin->position.x != first_x || bin->position.y != first_y)
+			continue;
+
+		if (CheckCollisionRecs(bounds, area))
+			da_append(*result, order);
+	}
+}
+
+void query_static_tiles(const Layer* layer, Rectangle area, Indices* result)
+{
+	if (!layer || !result)
+		return;
+
+	size_t first = result->size;
+	const StaticIndex* index = &layer->static_index;
+	BinRange range = get_bin_range(area);
+
+	// Look up the bins of the area when there are fewer of them than bins in the index
+	if (get_bin_count(range) < index->size)
+	{
+		for (int y = range.min.y; y <= range.max.y; y++)
+		{
+			for (int x = range.min.x; x <= range.max.x; x++)
+			{
+				StaticBin* bin = get_bin(index, (Vec2i){x, y});
+				if (bin)
+					query_bin(layer, bin, area, range, result);
+			}
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < index->capacity; i++)
+		{
+			StaticBin* bin = index->items[i];
+			if (!bin)
+				continue;
+
+			if (bin->position.x < range.min.x || bin->position.x > range.max.x ||
+				bin->position.y < range.min.y || bin->position.y > range.max.y)
+				continue;
+
+			query_bin(layer, bin, area, range, result);
+		}
+	}
+
+	for (size_t i = 0; i < index->large_tiles.size; i++)
+	{
+		size_t order = index->large_tiles.items[i];
+		if (CheckCollisionRecs(layer->static_tiles.items[get_tile_index(index, order)].bounds, area))
+			da_append(*result, order);
+	}
+
+	// Keep the draw order of overlapping tiles, then turn the keys into indices
+	if (result->size > first)
+		qsort(result->items + first, result->size - first, sizeof(size_t), compare_indices);
+	for (size_t i = first; i < result->size; i++)
+		result->items[i] = get_tile_index(index, result->items[i]);
+}
+
+long pick_static_tile(const Layer* layer, Vector2 point)
+{
+	if (!layer)
+		return -1;
+
+	// The topmost tile has the largest order key
+	long result = -1;
+	size_t result_order = 0;
+	const StaticIndex* index = &layer->static_index;
+
+	Vec2i position = { (int)floorf(point.x / STATIC_BIN_SIZE), (int)floorf(point.y / STATIC_BIN_SIZE) };
+	StaticBin* bin = get_bin(index, position);
+	if (bin)
+	{
+		for (size_t i = 0; i < bin->tiles.size; i++)
+		{
+			size_t order = bin->tiles.items[i];
+			if (result >= 0 && order <= result_order)
+				continue;
+
+			size_t tile_index = get_tile_index(index, order);
+			if (CheckCollisionPointRec(point, layer->static_tiles.items[tile_index].bounds))
+			{
+				result = tile_index;
+				result_order = order;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < index->large_tiles.size; i++)
+	{
+		size_t order = index->large_tiles.items[i];
+		if (result >= 0 && order <= result_order)
+			continue;
+
+		size_t tile_index = get_tile_index(index, order);
+		if (CheckCollisionPointRec(point, layer->static_tiles.items[tile_index].bounds))
+		{
+			result = tile_index;
+			result_order = order;
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <raylib.h>
+#include <stddef.h>
+
+#include "tilemap.h"
+
+// Appends the tile to the layer and the index, returns its index in static_tiles
+size_t add_static_tile(Layer* layer, Tile tile);
+// Removes the tile at index, the later tiles move down by one and keep their draw order
+void remove_static_tile(Layer* layer, size_t index);
+// Builds the index from scratch, for after bulk changes of static_tiles
+void rebuild_static_index(Layer* layer);
+void unload_static_index(StaticIndex* index);
+
+// Appends the indices of the static tiles overlapping area (layer space) to result, sorted in draw order
+void query_static_tiles(const Layer* layer, Rectangle area, Indices* result);
+// Returns the index of the topmost static tile containing point (layer space), or -1
+long pick_static_tile(const Layer* layer, Vector2 point);
@@ -0,0 +1,593 @@
+#include "tile_renderer.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <raylib.h>
+#include <raymath.h>
+#include <rlgl.h>
+
+#include "trace.h"
+#include "utils.h"
+
+#define CHUNK_QUADS (CHUNK_SIZE * CHUNK_SIZE)
+// Meshes of chunks that were not drawn for this many frames are freed
+#define MESH_MAX_UNUSED_FRAMES 300
+#define MESH_MAP_INIT_CAPACITY 64
+
+_Static_assert(CHUNK_QUADS * 4 <= 65536, "Chunk vertices must be addressable with unsigned short indices");
+
+static size_t hash_chunk_id(uint64_t id)
+{
+	id ^= id >> 33;
+	id *= 0xff51afd7ed558ccdULL;
+	id ^= id >> 33;
+
+	return (size_t)id;
+}
+
+static size_t mesh_map_find_slot(const TileRenderer* renderer, uint64_t chunk_id)
+{
+	size_t mask = renderer->capacity - 1;
+	size_t slot = hash_chunk_id(chunk_id) & mask;
+	while (renderer->items[slot] && renderer->items[slot]->chunk_id != chunk_id)
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+static void mesh_map_grow(TileRenderer* renderer)
+{
+	size_t capacity = renderer->capacity == 0 ? MESH_MAP_INIT_CAPACITY : renderer->capacity * 2;
+	ChunkMesh** items = calloc(capacity, sizeof(ChunkMesh*));
+	if (!items)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return;
+	}
+
+	ChunkMesh** old_items = renderer->items;
+	size_t old_capacity = renderer->capacity;
+	renderer->items = items;
+	renderer->capacity = capacity;
+
+	for (size_t i = 0; i < old_capacity; i++)
+	{
+		if (old_items[i])
+			renderer->items[mesh_map_find_slot(renderer, old_items[i]->chunk_id)] = old_items[i];
+	}
+
+	free(old_items);
+}
+
+static void unload_mesh_buffers(ChunkMesh* mesh)
+{
+	rlUnloadVertexArray(mesh->vao);
+	rlUnloadVertexBuffer(mesh->position_buffer);
+	rlUnloadVertexBuffer(mesh->texcoord_buffer);
+	rlUnloadVertexBuffer(mesh->color_buffer);
+	rlUnloadVertexBuffer(mesh->index_buffer);
+
+	mesh->vao = 0;
+	mesh->quad_capacity = 0;
+}
+
+static void unload_mesh(TileRenderer* renderer, ChunkMesh* mesh)
+{
+	if (mesh->vao != 0)
+		unload_mesh_buffers(mesh);
+	if (mesh->has_impostor)
+		da_append(renderer->free_impostors, mesh->impostor);
+	free(mesh->ranges.items);
+	free(mesh);
+}
+
+static void mesh_map_remove_at(TileRenderer* renderer, size_t hole)
+{
+	size_t mask = renderer->capacity - 1;
+
+	unload_mesh(renderer, renderer->items[hole]);
+	renderer->items[hole] = NULL;
+	renderer->size--;
+
+	// Backward shift deletion, same as the chunk directory
+	size_t slot = hole;
+	while (true)
+	{
+		slot = (slot + 1) & mask;
+		if (!renderer->items[slot])
+			break;
+
+		size_t home = hash_chunk_id(renderer->items[slot]->chunk_id) & mask;
+		bool stays = hole <= slot ? (hole < home && home <= slot) : (hole < home || home <= slot);
+		if (stays)
+			continue;
+
+		renderer->items[hole] = renderer->items[slot];
+		renderer->items[slot] = NULL;
+		hole = slot;
+	}
+}
+
+void build_chunk_geometry(const Tilemap* tilemap, const Chunk* chunk, ChunkGeometry* geometry)
+{
+	geometry->quad_count = 0;
+	geometry->ranges.size = 0;
+
+	// Counting sort of the tiles by atlas page, nearly always a single page
+	size_t page_count = tilemap->atlas.size;
+	int counts_buffer[8] = {0};
+	int* counts = page_count <= 8 ? counts_buffer : calloc(page_count, sizeof(int));
+	if (!counts)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return;
+	}
+
+	for (int y = 0; y < CHUNK_SIZE; y++)
+	{
+		for (int x = 0; x < CHUNK_SIZE; x++)
+		{
+			if (!chunk_has_tile(chunk, x, y))
+				continue;
+
+			size_t texture_index = chunk->textures[y * CHUNK_SIZE + x];
+			if (texture_index < tilemap->textures.size)
+				counts[tilemap->textures.items[texture_index].page]++;
+		}
+	}
+
+	int first_quad = 0;
+	for (size_t page = 0; page < page_count; page++)
+	{
+		if (counts[page] == 0)
+			continue;
+
+		ChunkDrawRange range = { .page = page, .first_quad = first_quad, .quad_count = 0 };
+		da_append(geometry->ranges, range);
+		first_quad += counts[page];
+	}
+
+	for (size_t r = 0; r < geometry->ranges.size; r++)
+	{
+		ChunkDrawRange* range = &geometry->ranges.items[r];
+		const AtlasPage* page = tilemap->atlas.items[range->page];
+		float page_width = page->image.width;
+		float page_height = page->image.height;
+
+		for (int y = 0; y < CHUNK_SIZE; y++)
+		{
+			for (int x = 0; x < CHUNK_SIZE; x++)
+			{
+				if (!chunk_has_tile(chunk, x, y))
+					continue;
+
+				size_t texture_index = chunk->textures[y * CHUNK_SIZE + x];
+				if (texture_index >= tilemap->textures.size)
+					continue;
+
+				AtlasRegion region = tilemap->textures.items[texture_index];
+				if (region.page != range->page)
+					continue;
+
+				int quad = range->first_quad + range->quad_count++;
+
+				float u0 = region.source.x / page_width;
+				float v0 = region.source.y / page_height;
+				float u1 = (region.source.x + region.source.width) / page_width;
+				float v1 = (region.source.y + region.source.height) / page_height;
+
+				// Counter clockwise: top left, bottom left, bottom right, top right
+				float positions[8] = { x, y, x, y + 1, x + 1, y + 1, x + 1, y };
+				float texcoords[8] = { u0, v0, u0, v1, u1, v1, u1, v0 };
+				memcpy(&geometry->positions[quad * 8], positions, sizeof(positions));
+				memcpy(&geometry->texcoords[quad * 8], texcoords, sizeof(texcoords));
+				Color tint = chunk->tint_palette[chunk->tints[y * CHUNK_SIZE + x]];
+				for (int v = 0; v < 4; v++)
+				{
+					unsigned char* color = &geometry->colors[quad * 16 + v * 4];
+					color[0] = tint.r;
+					color[1] = tint.g;
+					color[2] = tint.b;
+					color[3] = tint.a;
+				}
+			}
+		}
+	}
+
+	geometry->quad_count = first_quad;
+
+	if (counts != counts_buffer)
+		free(counts);
+}
+
+void build_chunk_impostor(const Tilemap* tilemap, const Chunk* chunk, Color* pixels, int stride)
+{
+	for (int y = 0; y < CHUNK_SIZE; y++)
+	{
+		for (int x = 0; x < CHUNK_SIZE; x++)
+		{
+			Color color = BLANK;
+			Tile tile = chunk_get_tile(chunk, x, y);
+			if (chunk_has_tile(chunk, x, y) && tile.texture_index < tilemap->textures.size)
+			{
+				Color average = tilemap->textures.items[tile.texture_index].average;
+				color.r = average.r * tile.tint.r / 255;
+				color.g = average.g * tile.tint.g / 255;
+				color.b = average.b * tile.tint.b / 255;
+				color.a = average.a * tile.tint.a / 255;
+			}
+
+			pixels[y * stride + x] = color;
+		}
+	}
+}
+
+static bool tile_renderer_init(TileRenderer* renderer)
+{
+	if (renderer->quad_indices)
+		return true;
+
+	renderer->scratch = calloc(1, sizeof(ChunkGeometry));
+	renderer->quad_indices = malloc(CHUNK_QUADS * 6 * sizeof(unsigned short));
+	if (!renderer->scratch || !renderer->quad_indices)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		free(renderer->scratch);
+		free(renderer->quad_indices);
+		renderer->scratch = NULL;
+		renderer->quad_indices = NULL;
+		return false;
+	}
+
+	for (int i = 0; i < CHUNK_QUADS; i++)
+	{
+		unsigned short* indices = &renderer->quad_indices[i * 6];
+		indices[0] = i * 4 + 0;
+		indices[1] = i * 4 + 1;
+		indices[2] = i * 4 + 3;
+		indices[3] = i * 4 + 1;
+		indices[4] = i * 4 + 2;
+		indices[5] = i * 4 + 3;
+	}
+
+	return true;
+}
+
+static void upload_mesh(TileRenderer* renderer, ChunkMesh* mesh, const ChunkGeometry* geometry)
+{
+	int quads = geometry->quad_count;
+
+	// Buffers only grow, smaller updates reuse them in place
+	if (mesh->vao != 0 && quads > mesh->quad_capacity)
+		unload_mesh_buffers(mesh);
+
+	if (mesh->vao == 0)
+	{
+		// Round up so a chunk being painted doesn't reallocate on every stroke
+		int capacity = quads < 64 ? 64 : quads;
+		if (capacity > CHUNK_QUADS / 2)
+			capacity = CHUNK_QUADS;
+
+		mesh->vao = rlLoadVertexArray();
+		rlEnableVertexArray(mesh->vao);
+
+		mesh->position_buffer = rlLoadVertexBuffer(NULL, capacity * 8 * sizeof(float), true);
+		rlSetVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION, 2, RL_FLOAT, false, 0, 0);
+		rlEnableVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION);
+
+		mesh->texcoord_buffer = rlLoadVertexBuffer(NULL, capacity * 8 * sizeof(float), true);
+		rlSetVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_TEXCOORD, 2, RL_FLOAT, false, 0, 0);
+		rlEnableVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_TEXCOORD);
+
+		mesh->color_buffer = rlLoadVertexBuffer(NULL, capacity * 16, true);
+		rlSetVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_COLOR, 4, RL_UNSIGNED_BYTE, true, 0, 0);
+		rlEnableVertexAttribute(RL_DEFAULT_SHADER_ATTRIB_LOCATION_COLOR);
+
+		mesh->index_buffer = rlLoadVertexBufferElement(renderer->quad_indices, capacity * 6 * sizeof(unsigned short), false);
+
+		rlDisableVertexArray();
+		mesh->quad_capacity = capacity;
+	}
+
+	if (quads > 0)
+	{
+		rlUpdateVertexBuffer(mesh->position_buffer, geometry->positions, quads * 8 * sizeof(float), 0);
+		rlUpdateVertexBuffer(mesh->texcoord_buffer, geometry->texcoords, quads * 8 * sizeof(float), 0);
+		rlUpdateVertexBuffer(mesh->color_buffer, geometry->colors, quads * 16, 0);
+	}
+
+	mesh->ranges.size = 0;
+	for (size_t i = 0; i < geometry->ranges.size; i++)
+		da_append(mesh->ranges, geometry->ranges.items[i]);
+}
+
+static ChunkMesh* get_entry(TileRenderer* renderer, const Chunk* chunk)
+{
+	if (!tile_renderer_init(renderer))
+		return NULL;
+
+	if ((renderer->size + 1) * 10 > renderer->capacity * 7)
+		mesh_map_grow(renderer);
+	if (renderer->capacity == 0)
+		return NULL;
+
+	size_t slot = mesh_map_find_slot(renderer, chunk->id);
+	ChunkMesh* mesh = renderer->items[slot];
+	if (!mesh)
+	{
+		mesh = calloc(1, sizeof(ChunkMesh));
+		if (!mesh)
+		{
+			fprintf(stderr, "ERROR: Could not allocate enough space\n");
+			return NULL;
+		}
+
+		mesh->chunk_id = chunk->id;
+		renderer->items[slot] = mesh;
+		renderer->size++;
+	}
+
+	mesh->last_used_frame = renderer->frame;
+
+	return mesh;
+}
+
+static void update_mesh(TileRenderer* renderer, const Tilemap* tilemap, const Chunk* chunk, ChunkMesh* mesh)
+{
+	if (mesh->revision == chunk->revision && mesh->vao != 0)
+		return;
+
+	TRACE_BEGIN("update chunk mesh");
+	build_chunk_geometry(tilemap, chunk, renderer->scratch);
+	upload_mesh(renderer, mesh, renderer->scratch);
+	TRACE_END();
+	mesh->revision = chunk->revision;
+}
+
+static void draw_mesh(const Tilemap* tilemap, const ChunkMesh* mesh, Vector2 origin, TileRendererStats* stats)
+{
+	if (mesh->ranges.size == 0)
+		return;
+
+	// Keep the order with whatever raylib has batched so far
+	rlDrawRenderBatchActive();
+
+	Matrix model = MatrixTranslate(origin.x, origin.y, 0.0f);
+	Matrix model_view = MatrixMultiply(model, MatrixMultiply(rlGetMatrixTransform(), rlGetMatrixModelview()));
+	Matrix mvp = MatrixMultiply(model_view, rlGetMatrixProjection());
+
+	int* locs = rlGetShaderLocsDefault();
+	float white[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	int texture_slot = 0;
+
+	rlEnableShader(rlGetShaderIdDefault());
+	rlSetUniformMatrix(locs[RL_SHADER_LOC_MATRIX_MVP], mvp);
+	rlSetUniform(locs[RL_SHADER_LOC_COLOR_DIFFUSE], white, RL_SHADER_UNIFORM_VEC4, 1);
+	rlSetUniform(locs[RL_SHADER_LOC_MAP_DIFFUSE], &texture_slot, RL_SHADER_UNIFORM_INT, 1);
+
+	rlEnableVertexArray(mesh->vao);
+	rlActiveTextureSlot(0);
+	for (size_t i = 0; i < mesh->ranges.size; i++)
+	{
+		ChunkDrawRange range = mesh->ranges.items[i];
+		if (range.page >= tilemap->atlas.size)
+			continue;
+
+		unsigned int texture_id = tilemap->atlas.items[range.page]->texture.id;
+		if (texture_id == 0)
+			continue;
+
+		rlEnableTexture(texture_id);
+		rlDrawVertexArrayElements(range.first_quad * 6, range.quad_count * 6, NULL);
+		stats->tiles_drawn += range.quad_count;
+		stats->draw_calls++;
+		stats->texture_binds++;
+	}
+	rlDisableTexture();
+	rlDisableVertexArray();
+	rlDisableShader();
+}
+
+static bool allocate_impostor(TileRenderer* renderer, int* slot)
+{
+	if (renderer->free_impostors.size == 0)
+	{
+		ImpostorPage* page = calloc(1, sizeof(ImpostorPage));
+		if (!page)
+		{
+			fprintf(stderr, "ERROR: Could not allocate enough space\n");
+			return false;
+		}
+
+		page->image = GenImageColor(IMPOSTOR_PAGE_SIZE, IMPOSTOR_PAGE_SIZE, BLANK);
+		page->dirty = true;
+		da_append(renderer->impostor_pages, page);
+
+		// Pushed in reverse so cells are handed out in order
+		int first = (renderer->impostor_pages.size - 1) * IMPOSTORS_PER_PAGE;
+		for (int i = IMPOSTORS_PER_PAGE - 1; i >= 0; i--)
+			da_append(renderer->free_impostors, first + i);
+	}
+
+	*slot = renderer->free_impostors.items[--renderer->free_impostors.size];
+
+	return true;
+}
+
+static Rectangle get_impostor_rect(int slot)
+{
+	int cell = slot % IMPOSTORS_PER_PAGE;
+	Rectangle result =
+	{
+		.x = (cell % IMPOSTORS_PER_ROW) * CHUNK_SIZE,
+		.y = (cell / IMPOSTORS_PER_ROW) * CHUNK_SIZE,
+		.width = CHUNK_SIZE,
+		.height = CHUNK_SIZE,
+	};
+
+	return result;
+}
+
+static void update_impostor(TileRenderer* renderer, const Tilemap* tilemap, const Chunk* chunk, ChunkMesh* mesh)
+{
+	if (mesh->has_impostor && mesh->impostor_revision == chunk->revision)
+		return;
+
+	if (!mesh->has_impostor)
+	{
+		if (!allocate_impostor(renderer, &mesh->impostor))
+			return;
+		mesh->has_impostor = true;
+	}
+
+	ImpostorPage* page = renderer->impostor_pages.items[mesh->impostor / IMPOSTORS_PER_PAGE];
+	Rectangle rect = get_impostor_rect(mesh->impostor);
+	Color* pixels = page->image.data;
+	build_chunk_impostor(tilemap, chunk, &pixels[(int)rect.y * IMPOSTOR_PAGE_SIZE + (int)rect.x], IMPOSTOR_PAGE_SIZE);
+
+	page->dirty = true;
+	mesh->impostor_revision = chunk->revision;
+}
+
+static void upload_impostor_pages(TileRenderer* renderer)
+{
+	for (size_t i = 0; i < renderer->impostor_pages.size; i++)
+	{
+		ImpostorPage* page = renderer->impostor_pages.items[i];
+		if (!page->dirty)
+			continue;
+
+		TRACE_BEGIN("upload impostor page");
+		if (page->texture.id == 0)
+			page->texture = LoadTextureFromImage(page->image);
+		else
+			UpdateTexture(page->texture, page->image.data);
+
+		// Further zoomed out views sample the smaller levels of the pyramid
+		GenTextureMipmaps(&page->texture);
+		SetTextureFilter(page->texture, TEXTURE_FILTER_TRILINEAR);
+		page->dirty = false;
+		TRACE_END();
+	}
+}
+
+void tile_renderer_draw_chunks(TileRenderer* renderer, const Tilemap* tilemap, Vector2 layer_origin, const Chunk* const* chunks, size_t count)
+{
+	if (!renderer || !tilemap || count == 0)
+		return;
+
+	if (renderer->zoom >= LOD_ZOOM_THRESHOLD)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			ChunkMesh* mesh = get_entry(renderer, chunks[i]);
+			if (!mesh)
+				continue;
+
+			Vector2 origin =
+			{
+				layer_origin.x + chunks[i]->position.x * CHUNK_SIZE,
+				layer_origin.y + chunks[i]->position.y * CHUNK_SIZE,
+			};
+
+			update_mesh(renderer, tilemap, chunks[i], mesh);
+			draw_mesh(tilemap, mesh, origin, &renderer->stats);
+		}
+
+		return;
+	}
+
+	// Every visible impostor has to be on the GPU before the batch referencing it is drawn
+	for (size_t i = 0; i < count; i++)
+	{
+		ChunkMesh* mesh = get_entry(renderer, chunks[i]);
+		if (mesh)
+			update_impostor(renderer, tilemap, chunks[i], mesh);
+	}
+	upload_impostor_pages(renderer);
+
+	// Cells are packed edge to edge: keep samples half a texel inside the cell, a texel of the
+	// coarsest mip level trilinear filtering reads at this zoom covering up to 2 / zoom cells
+	float inset = fminf(fmaxf(0.5f, 1.0f / renderer->zoom), CHUNK_SIZE * 0.5f - 0.5f);
+
+	const ImpostorPage* previous_page = NULL;
+	for (size_t i = 0; i < count; i++)
+	{
+		ChunkMesh* mesh = get_entry(renderer, chunks[i]);
+		if (!mesh || !mesh->has_impostor)
+			continue;
+
+		Rectangle dest =
+		{
+			.x = layer_origin.x + chunks[i]->position.x * CHUNK_SIZE,
+			.y = layer_origin.y + chunks[i]->position.y * CHUNK_SIZE,
+			.width = CHUNK_SIZE,
+			.height = CHUNK_SIZE,
+		};
+
+		const ImpostorPage* page = renderer->impostor_pages.items[mesh->impostor / IMPOSTORS_PER_PAGE];
+		Rectangle source = get_impostor_rect(mesh->impostor);
+		source.x += inset;
+		source.y += inset;
+		source.width -= 2.0f * inset;
+		source.height -= 2.0f * inset;
+		DrawTexturePro(page->texture, source, dest, (Vector2){0.0f, 0.0f}, 0.0f, WHITE);
+
+		renderer->stats.tiles_drawn += chunks[i]->tile_count;
+		if (page != previous_page)
+		{
+			renderer->stats.draw_calls++;
+			renderer->stats.texture_binds++;
+			previous_page = page;
+		}
+	}
+}
+
+void tile_renderer_end_frame(TileRenderer* renderer)
+{
+	if (!renderer || renderer->partial)
+		return;
+
+	for (size_t i = 0; i < renderer->capacity; i++)
+	{
+		// Removing can shift a later entry into this slot, so check it again
+		while (renderer->items[i] && renderer->frame - renderer->items[i]->last_used_frame > MESH_MAX_UNUSED_FRAMES)
+			mesh_map_remove_at(renderer, i);
+	}
+
+	renderer->frame++;
+}
+
+void tile_renderer_unload(TileRenderer* renderer)
+{
+	if (!renderer)
+		return;
+
+	for (size_t i = 0; i < renderer->capacity; i++)
+	{
+		if (renderer->items[i])
+			unload_mesh(renderer, renderer->items[i]);
+	}
+	free(renderer->items);
+
+	for (size_t i = 0; i < renderer->impostor_pages.size; i++)
+	{
+		ImpostorPage* page = renderer->impostor_pages.items[i];
+		if (page->texture.id != 0)
+			UnloadTexture(page->texture);
+		UnloadImage(page->image);
+		free(page);
+	}
+	free(renderer->impostor_pages.items);
+	free(renderer->free_impostors.items);
+
+	if (renderer->scratch)
+		free(renderer->scratch->ranges.items);
+	free(renderer->scratch);
+	free(renderer->quad_indices);
+
+	*renderer = (TileRenderer){0};
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <raylib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tilemap.h"
+
+// Quads of a chunk that sample from the same atlas page
+typedef struct
+{
+	size_t page;
+	int first_quad;
+	int quad_count;
+} ChunkDrawRange;
+
+typedef struct
+{
+	ChunkDrawRange* items;
+	size_t size;
+	size_t capacity;
+} ChunkDrawRanges;
+
+// CPU side geometry of a chunk, positions are relative to the first cell of the chunk
+typedef struct
+{
+	float positions[CHUNK_SIZE * CHUNK_SIZE * 4 * 2];
+	float texcoords[CHUNK_SIZE * CHUNK_SIZE * 4 * 2];
+	unsigned char colors[CHUNK_SIZE * CHUNK_SIZE * 4 * 4];
+	int quad_count;
+	ChunkDrawRanges ranges;
+} ChunkGeometry;
+
+// Below this many screen pixels per tile, chunks are drawn from their impostor
+#define LOD_ZOOM_THRESHOLD 4.0f
+
+// Impostors are CHUNK_SIZE x CHUNK_SIZE images (one pixel per cell) packed in mipmapped pages,
+// cells are aligned to their size so every mip level of a cell stays inside it. They are drawn
+// from a slightly inset area so filtering doesn't reach the next cell.
+#define IMPOSTOR_PAGE_SIZE 1024
+#define IMPOSTORS_PER_ROW (IMPOSTOR_PAGE_SIZE / CHUNK_SIZE)
+#define IMPOSTORS_PER_PAGE (IMPOSTORS_PER_ROW * IMPOSTORS_PER_ROW)
+
+typedef struct
+{
+	Image image;
+	Texture2D texture;
+	bool dirty;
+} ImpostorPage;
+
+typedef struct
+{
+	ImpostorPage** items;
+	size_t size;
+	size_t capacity;
+} ImpostorPages;
+
+typedef struct
+{
+	int* items;
+	size_t size;
+	size_t capacity;
+} ImpostorSlots;
+
+// GPU data of a chunk, rebuilt lazily when the chunk revision changes
+typedef struct
+{
+	uint64_t chunk_id;
+	uint64_t last_used_frame;
+
+	// Impostor, slot is page * IMPOSTORS_PER_PAGE + cell
+	bool has_impostor;
+	int impostor;
+	uint32_t impostor_revision;
+
+	// Quad mesh
+	uint32_t revision;
+
+	unsigned int vao;
+	unsigned int position_buffer;
+	unsigned int texcoord_buffer;
+	unsigned int color_buffer;
+	unsigned int index_buffer;
+	int quad_capacity;
+
+	ChunkDrawRanges ranges;
+} ChunkMesh;
+
+// Work done by the draws since the caller last cleared the counters. Draws batched by raylib
+// (impostors, static tiles) count one draw call and texture bind per change of texture.
+typedef struct
+{
+	uint64_t tiles_drawn;
+	uint64_t draw_calls;
+	uint64_t texture_binds;
+} TileRendererStats;
+
+struct TileRenderer
+{
+	// Open addressing hash map<chunk id, ChunkMesh*> (linear probing, empty slots are NULL)
+	ChunkMesh** items;
+	size_t size;
+	size_t capacity;
+
+	uint64_t frame;
+	float zoom; // Screen pixels per tile of the view being drawn, set before draw_tilemap
+	// Set before draw_tilemap when the view is only part of what is on screen (a redrawn edit):
+	// the chunks outside of it are still visible, so the frame doesn't age or free their meshes
+	bool partial;
+	ChunkGeometry* scratch;
+	unsigned short* quad_indices; // Index pattern for CHUNK_SIZE * CHUNK_SIZE quads
+
+	ImpostorPages impostor_pages;
+	ImpostorSlots free_impostors;
+
+	TileRendererStats stats;
+};
+
+// Fills geometry with one quad per tile of the chunk, grouped by atlas page
+void build_chunk_geometry(const Tilemap* tilemap, const Chunk* chunk, ChunkGeometry* geometry);
+
+// Writes one pixel per cell, the average color of its texture times its tint
+void build_chunk_impostor(const Tilemap* tilemap, const Chunk* chunk, Color* pixels, int stride);
+
+// Draws the chunks of a layer whose origin (world position of cell 0, 0) is layer_origin
+// with the current rlgl matrices, using impostors when zoomed out below LOD_ZOOM_THRESHOLD
+void tile_renderer_draw_chunks(TileRenderer* renderer, const Tilemap* tilemap, Vector2 layer_origin, const Chunk* const* chunks, size_t count);
+// Frees the meshes of chunks that were not drawn for a while, call once per frame.
+// Partial frames are not counted.
+void tile_renderer_end_frame(TileRenderer* renderer);
+void tile_renderer_unload(TileRenderer* renderer);
@@ -1,524 +1,1416 @@
 #include "tilemap.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
 #include <raylib.h>
 
+#include "parallel.h"
+#include "static_index.h"
+#include "tile_renderer.h"
+#include "trace.h"
 #include "utils.h"
 
-static Rectangle get_tile_rect(const Tilemap* tilemap, const Layer* layer, Tile tile, bool is_static)
+// Occupancy of a chunk row is stored in an uint32_t
+_Static_assert(CHUNK_SIZE <= 32, "CHUNK_SIZE must fit in a chunk row bitmask");
+
+#define TILE_GRID_INIT_CAPACITY 16
+// Chunks are created from several threads when loading
+static atomic_uint_fast64_t next_chunk_id = 1;
+// Grow when size > capacity * 7 / 10
+#define TILE_GRID_MAX_LOAD_NUM 7
+#define TILE_GRID_MAX_LOAD_DEN 10
+
+size_t hash_vec2i(Vec2i value)
 {
-	if (is_static)
-	{
-		Rectangle result = tile.bounds;
-		result.x += tilemap->offset.x + layer->offset.x;
-		result.y += tilemap->offset.y + layer->offset.y;
+	uint64_t hash = (uint64_t)(uint32_t)value.x | ((uint64_t)(uint32_t)value.y << 32);
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+
+	return (size_t)hash;
+}
 
-		return result;
-	}
+bool vec2i_equals(Vec2i a, Vec2i b)
+{
+	return a.x == b.x && a.y == b.y;
+}
 
-	Rectangle result =
-	{
-		.x = tilemap->offset.x + layer->offset.x + tile.tilemap_index.x,
-		.y = tilemap->offset.y + layer->offset.y + tile.tilemap_index.y,
-		.width = 1.0f,
-		.height = 1.0f,
-	};
+static int floor_div(int value, int divisor)
+{
+	int result = value / divisor;
+	if (value % divisor != 0 && value < 0)
+		result--;
 
 	return result;
 }
 
-static void draw_layer(const Tilemap* tilemap, const Layer* layer)
+Vec2i get_chunk_position(Vec2i tilemap_index)
 {
-	for (size_t i = 0; i < layer->tiles.size; i++)
+	Vec2i result =
 	{
-		Tile tile = layer->tiles.items[i];
-		Texture2D texture = tilemap->textures.items[tile.texture_index];
-    	Rectangle source = { 0.0f, 0.0f, (float)texture.width, (float)texture.height };
-		Rectangle dest = get_tile_rect(tilemap, layer, tile, false);
-		DrawTexturePro(texture, source, dest, (Vector2){0.0f, 0.0f}, 0.0f, tile.tint);
-	}
+		.x = floor_div(tilemap_index.x, CHUNK_SIZE),
+		.y = floor_div(tilemap_index.y, CHUNK_SIZE),
+	};
 
-	for (size_t i = 0; i < layer->static_tiles.size; i++)
-	{
-		Tile tile = layer->static_tiles.items[i];
-		Texture2D texture = tilemap->textures.items[tile.texture_index];
-    	Rectangle source = { 0.0f, 0.0f, (float)texture.width, (float)texture.height };
-		Rectangle dest = get_tile_rect(tilemap, layer, tile, true);
-		DrawTexturePro(texture, source, dest, (Vector2){0.0f, 0.0f}, 0.0f, tile.tint);
-	}
+	return result;
 }
 
+bool chunk_has_tile(const Chunk* chunk, int x, int y)
+{
+	return (chunk->occupied[y] >> x) & 1u;
+}
 
-void draw_tilemap(const Tilemap* tilemap)
+Tile chunk_get_tile(const Chunk* chunk, int x, int y)
 {
-	for (size_t i = 0; i < tilemap->layers.size; i++)
-		draw_layer(tilemap, &tilemap->layers.items[i]);
+	int cell = y * CHUNK_SIZE + x;
+	Tile result =
+	{
+		.tilemap_index = { chunk->position.x * CHUNK_SIZE + x, chunk->position.y * CHUNK_SIZE + y },
+		.texture_index = chunk->textures[cell],
+		.tint = chunk->tint_palette[chunk->tints[cell]],
+	};
 
-	draw_layer(tilemap, &tilemap->main_layer);
+	return result;
 }
 
-void add_tileset(Tilemap* tilemap, const char* filepath, int width, int height)
+static bool color_equals(Color a, Color b)
 {
-	Image tileset = LoadImage(filepath);
+	return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
 
-	if (!IsImageReady(tileset))
-	{
-		fprintf(stderr, "ERROR: Failed to load image: %s\n", filepath);
-		return;
-	}
-	
-	if (width <= 0 || height <= 0)
+// Drops the palette entries no occupied cell uses
+static void compact_chunk_tints(Chunk* chunk)
+{
+	bool used[CHUNK_TINTS] = {0};
+	for (int y = 0; y < CHUNK_SIZE; y++)
 	{
-		fprintf(stderr, "ERROR: tileset [%s] is not divisible in %dx%d tiles\n", filepath, width, height);
-		goto defer_return;
+		for (uint32_t bits = chunk->occupied[y]; bits; bits &= bits - 1)
+			used[chunk->tints[y * CHUNK_SIZE + __builtin_ctz(bits)]] = true;
 	}
 
-	if (tileset.width % width != 0 || tileset.height % height != 0)
+	// Cells being written may still hold any index, they are overwritten right after
+	uint8_t remap[CHUNK_TINTS] = {0};
+	int kept = 0;
+	for (int i = 0; i < chunk->tint_count; i++)
 	{
-		fprintf(stderr, "ERROR: tileset [%s] is not divisible in %dx%d tiles\n", filepath, width, height);
-		goto defer_return;
-	}
+		if (!used[i])
+			continue;
 
-	int tile_width = tileset.width / width;
-	int tile_height = tileset.height / height;
+		remap[i] = kept;
+		chunk->tint_palette[kept++] = chunk->tint_palette[i];
+	}
 
-	for (int j = 0; j < height; j++)
+	for (int y = 0; y < CHUNK_SIZE; y++)
 	{
-		for (int i = 0; i < width; i++)
+		for (uint32_t bits = chunk->occupied[y]; bits; bits &= bits - 1)
 		{
-			Rectangle tile_rect =
-			{
-				.x = i * tile_width,
-				.y = j * tile_height,
-				.width = tile_width,
-				.height = tile_height,
-			};
-
-			Image tile_image = ImageFromImage(tileset, tile_rect);
-			Texture tile_texture = LoadTextureFromImage(tile_image);
-
-			da_append(tilemap->textures, tile_texture);
-
-			UnloadImage(tile_image);
+			int cell = y * CHUNK_SIZE + __builtin_ctz(bits);
+			chunk->tints[cell] = remap[chunk->tints[cell]];
 		}
 	}
-	
-defer_return:
-	UnloadImage(tileset);
+
+	chunk->tint_count = kept;
 }
 
-static void remove_texture_from_layer(Layer* layer, size_t texture_index)
+// Index of tint in the palette of the chunk, added if it isn't there. A chunk using CHUNK_TINTS
+// different tints already gets the closest one instead, with a warning.
+static uint8_t get_chunk_tint(Chunk* chunk, Color tint)
 {
-	if (!layer)
-		return;
+	for (int i = 0; i < chunk->tint_count; i++)
+	{
+		if (color_equals(chunk->tint_palette[i], tint))
+			return i;
+	}
 
-	// Normal tiles
-	for (size_t i = 0; i < layer->tiles.size; i++)
+	if (chunk->tint_count == CHUNK_TINTS)
+		compact_chunk_tints(chunk);
+
+	if (chunk->tint_count < CHUNK_TINTS)
 	{
-		Tile* tile = &layer->tiles.items[i];
-		if (tile->texture_index == texture_index)
-		{
-			da_remove_at(layer->tiles, i);
-			i--;
-		}
-		else if (tile->texture_index > texture_index)
-			tile->texture_index--;
+		chunk->tint_palette[chunk->tint_count] = tint;
+		return chunk->tint_count++;
 	}
 
-	// Static tiles
-	for (size_t i = 0; i < layer->static_tiles.size; i++)
+	int closest = 0;
+	int closest_distance = INT32_MAX;
+	for (int i = 0; i < CHUNK_TINTS; i++)
 	{
-		Tile* tile = &layer->static_tiles.items[i];
-		if (tile->texture_index == texture_index)
+		Color color = chunk->tint_palette[i];
+		int distance = (color.r - tint.r) * (color.r - tint.r) + (color.g - tint.g) * (color.g - tint.g) +
+			(color.b - tint.b) * (color.b - tint.b) + (color.a - tint.a) * (color.a - tint.a);
+		if (distance < closest_distance)
 		{
-			da_remove_at(layer->static_tiles, i);
-			i--;
+			closest = i;
+			closest_distance = distance;
 		}
-		else if (tile->texture_index > texture_index)
-			tile->texture_index--;
 	}
-}
-
-void remove_texture(Tilemap* tilemap, size_t texture_index)
-{
-	if (!tilemap)
-		return;
-
-	if (texture_index >= tilemap->textures.size)
-		return;
-
-	remove_texture_from_layer(&tilemap->main_layer, texture_index);
 
-	for (size_t i = 0; i < tilemap->layers.size; i++)
-		remove_texture_from_layer(&tilemap->layers.items[i], texture_index);
+	// Once per chunk and tint in a row, a fill can write many cells of it
+	static _Thread_local uint64_t warned_chunk;
+	static _Thread_local Color warned_tint;
+	if (warned_chunk != chunk->id || !color_equals(warned_tint, tint))
+	{
+		Color used = chunk->tint_palette[closest];
+		fprintf(stderr, "WARNING: Chunk (%d, %d) already uses %d tints, tint (%d, %d, %d, %d) is stored as (%d, %d, %d, %d)\n",
+			chunk->position.x, chunk->position.y, CHUNK_TINTS, tint.r, tint.g, tint.b, tint.a, used.r, used.g, used.b, used.a);
+		warned_chunk = chunk->id;
+		warned_tint = tint;
+	}
 
-	UnloadTexture(tilemap->textures.items[texture_index]);
-	da_remove_at_keep_order(tilemap->textures, texture_index);
+	return closest;
 }
 
-void unload_tileset(Tilemap* tilemap)
+void chunk_set_cell(Chunk* chunk, int x, int y, size_t texture_index, Color tint)
 {
-	for (size_t i = 0; i < tilemap->textures.size; i++)
-		UnloadTexture(tilemap->textures.items[i]);
-
-	tilemap->textures.size = 0;
+	int cell = y * CHUNK_SIZE + x;
+	chunk->textures[cell] = texture_index < TILEMAP_MAX_TEXTURES ? texture_index : TILEMAP_MAX_TEXTURES;
+	chunk->tints[cell] = get_chunk_tint(chunk, tint);
 }
 
-void unload_layer(Layer* layer)
+// Returns the slot holding the chunk at position, or the empty slot where it should be inserted
+static size_t tile_grid_find_slot(const TileGrid* grid, Vec2i position)
 {
-	// Vector2 offset;
-	layer->offset = (Vector2){0.0f, 0.0f};
-
-	// Tiles tiles;
-	free(layer->tiles.items);
-	layer->tiles.size = 0;
-	layer->tiles.capacity = 0;
+	size_t mask = grid->capacity - 1;
+	size_t slot = hash_vec2i(position) & mask;
+	while (grid->items[slot] && !vec2i_equals(grid->items[slot]->position, position))
+		slot = (slot + 1) & mask;
 
-	// Tiles static_tiles;
-	free(layer->static_tiles.items);
-	layer->static_tiles.size = 0;
-	layer->static_tiles.capacity = 0;
+	return slot;
 }
 
-void unload_tilemap(Tilemap* tilemap)
+static void tile_grid_rehash(TileGrid* grid, size_t new_capacity)
 {
-	// Offset
-	tilemap->offset = (Vector2){0.0f, 0.0f};
+	TileGrid result =
+	{
+		.items = calloc(new_capacity, sizeof(Chunk*)),
+		.size = grid->size,
+		.capacity = new_capacity,
+		.tile_count = grid->tile_count,
+	};
 
-	// main_layer;
-	unload_layer(&tilemap->main_layer);
-	
-	// layers;
-	for (size_t i = 0; i < tilemap->layers.size; i++)
-		unload_layer(&tilemap->layers.items[i]);
-	free(tilemap->layers.items);
-	tilemap->layers.capacity = 0;
-	tilemap->layers.size = 0;
+	if (!result.items)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return;
+	}
 
-	// Textures
-	unload_tileset(tilemap);
-	free(tilemap->textures.items);
-	tilemap->textures.capacity = 0;
-}
+	for (size_t i = 0; i < grid->capacity; i++)
+	{
+		if (!grid->items[i])
+			continue;
 
+		size_t slot = tile_grid_find_slot(&result, grid->items[i]->position);
+		result.items[slot] = grid->items[i];
+	}
 
+	free(grid->items);
+	*grid = result;
+}
 
-// TODO: make save and load system architecture independent
-static const char* MAGIC = "MIAU";
-static void write_vector2(FILE* file, const Vector2 value)
+void tile_grid_reserve(TileGrid* grid, size_t amount)
 {
-	if (!file)
+	if (!grid)
 		return;
 
-	fwrite(&value.x, sizeof(value.x), 1, file);
-	fwrite(&value.y, sizeof(value.y), 1, file);
+	size_t capacity = grid->capacity == 0 ? TILE_GRID_INIT_CAPACITY : grid->capacity;
+	while (amount * TILE_GRID_MAX_LOAD_DEN > capacity * TILE_GRID_MAX_LOAD_NUM)
+		capacity *= 2;
+
+	if (capacity != grid->capacity)
+		tile_grid_rehash(grid, capacity);
 }
 
-static void write_vector2i(FILE* file, const Vec2i value)
+const Chunk* tile_grid_get_chunk(const TileGrid* grid, Vec2i position)
 {
-	if (!file)
-		return;
+	if (!grid || grid->size == 0)
+		return NULL;
 
-	fwrite(&value.x, sizeof(value.x), 1, file);
-	fwrite(&value.y, sizeof(value.y), 1, file);
+	return grid->items[tile_grid_find_slot(grid, position)];
 }
 
-static void write_rectangle(FILE* file, const Rectangle rect)
+static void release_chunk(Chunk* chunk)
 {
-	if (!file)
-		return;
-
-	fwrite(&rect.x, sizeof(rect.x), 1, file);
-	fwrite(&rect.y, sizeof(rect.y), 1, file);
-	fwrite(&rect.width, sizeof(rect.width), 1, file);
-	fwrite(&rect.height, sizeof(rect.height), 1, file);
+	if (atomic_fetch_sub(&chunk->shares, 1) == 0)
+		free(chunk);
 }
 
-static void write_color(FILE* file, const Color color)
+// Replaces a chunk shared with snapshots by a private copy, returns the chunk in slot
+static Chunk* tile_grid_make_writable(TileGrid* grid, size_t slot)
 {
-	if (!file)
-		return;
+	Chunk* chunk = grid->items[slot];
+	if (atomic_load(&chunk->shares) == 0)
+		return chunk;
 
-	fwrite(&color.r, sizeof(color.r), 1, file);
-	fwrite(&color.g, sizeof(color.g), 1, file);
-	fwrite(&color.b, sizeof(color.b), 1, file);
-	fwrite(&color.a, sizeof(color.a), 1, file);
-}
+	Chunk* copy = malloc(sizeof(Chunk));
+	if (!copy)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return NULL;
+	}
+	// Everything but shares, which snapshots may be releasing right now
+	size_t before = offsetof(Chunk, shares);
+	size_t after = before + sizeof(chunk->shares);
+	memcpy(copy, chunk, before);
+	memcpy((char*)copy + after, (const char*)chunk + after, sizeof(Chunk) - after);
+	atomic_init(&copy->shares, 0);
+
+	grid->items[slot] = copy;
+	release_chunk(chunk);
 
+	return copy;
+}
 
-static void write_tile(FILE* file, const Tile tile, bool is_static)
+static void tile_grid_remove_chunk(TileGrid* grid, Vec2i position)
 {
-	if (!file)
+	if (!grid || grid->size == 0)
 		return;
 
-	
-	// tilemap_index;
-	// bounds;
-	if (is_static)
-		write_rectangle(file, tile.bounds);
-	else
-		write_vector2i(file, tile.tilemap_index);
-	
-	// size_t texture_index;
-	
-	fwrite(&tile.texture_index, sizeof(tile.texture_index), 1, file);
+	size_t mask = grid->capacity - 1;
+	size_t hole = tile_grid_find_slot(grid, position);
+	if (!grid->items[hole])
+		return;
+
+	release_chunk(grid->items[hole]);
+	grid->items[hole] = NULL;
+	grid->size--;
 
-	// Color tint;
-	write_color(file, tile.tint);
+	// Backward shift deletion: move later entries of the probe chain into the hole
+	// so lookups never need tombstones
+	size_t slot = hole;
+	while (true)
+	{
+		slot = (slot + 1) & mask;
+		if (!grid->items[slot])
+			break;
+
+		size_t home = hash_vec2i(grid->items[slot]->position) & mask;
+		// Can't move the entry if its home lies cyclically in (hole, slot]
+		bool stays = hole <= slot ? (hole < home && home <= slot) : (hole < home || home <= slot);
+		if (stays)
+			continue;
+
+		grid->items[hole] = grid->items[slot];
+		grid->items[slot] = NULL;
+		hole = slot;
+	}
 }
 
-static void write_layer(FILE* file, const Layer layer)
+Chunk* tile_grid_add_chunk(TileGrid* grid, Vec2i position)
 {
-	if (!file)
-		return;
+	if (!grid)
+		return NULL;
 
-	// Offset;
-	write_vector2(file, layer.offset);
+	if (grid->size > 0)
+	{
+		size_t slot = tile_grid_find_slot(grid, position);
+		if (grid->items[slot])
+			return tile_grid_make_writable(grid, slot);
+	}
 
-	// Tiles;
-	fwrite(&layer.tiles.size, sizeof(layer.tiles.size), 1, file);
-	for (size_t i = 0; i < layer.tiles.size; i++)
-		write_tile(file, layer.tiles.items[i], false);
+	tile_grid_reserve(grid, grid->size + 1);
+	if (grid->capacity == 0)
+		return NULL;
 
+	Chunk* chunk = calloc(1, sizeof(Chunk));
+	if (!chunk)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return NULL;
+	}
+	chunk->position = position;
+	chunk->id = atomic_fetch_add(&next_chunk_id, 1);
 
-	// Static tiles;
-	fwrite(&layer.static_tiles.size, sizeof(layer.static_tiles.size), 1, file);
-	for (size_t i = 0; i < layer.static_tiles.size; i++)
-		write_tile(file, layer.static_tiles.items[i], true);
+	grid->items[tile_grid_find_slot(grid, position)] = chunk;
+	grid->size++;
 
+	return chunk;
 }
 
-static void write_texture(FILE* file, Texture2D texture)
+bool tile_grid_get(const TileGrid* grid, Vec2i index, Tile* result)
 {
-	if (!file)
-		return;
+	const Chunk* chunk = tile_grid_get_chunk(grid, get_chunk_position(index));
+	if (!chunk)
+		return false;
 
-	Image image = LoadImageFromTexture(texture);
+	int x = index.x - chunk->position.x * CHUNK_SIZE;
+	int y = index.y - chunk->position.y * CHUNK_SIZE;
+	if (!chunk_has_tile(chunk, x, y))
+		return false;
 
-	fwrite(&image.width, sizeof(image.width), 1, file);
-	fwrite(&image.height, sizeof(image.height), 1, file);
-	fwrite(&image.format, sizeof(image.format), 1, file);
+	if (result)
+		*result = chunk_get_tile(chunk, x, y);
+	return true;
+}
 
-	size_t size = GetPixelDataSize(image.width, image.height, image.format);
-	fwrite(image.data, size, 1, file);
+void tile_grid_set(TileGrid* grid, Tile tile)
+{
+	if (!grid)
+		return;
 
-	UnloadImage(image);
-}
+	Vec2i position = get_chunk_position(tile.tilemap_index);
+	Chunk* chunk = tile_grid_add_chunk(grid, position);
+	if (!chunk)
+		return;
 
+	int x = tile.tilemap_index.x - position.x * CHUNK_SIZE;
+	int y = tile.tilemap_index.y - position.y * CHUNK_SIZE;
+	if (!chunk_has_tile(chunk, x, y))
+	{
+		chunk->occupied[y] |= 1u << x;
+		chunk->tile_count++;
+		grid->tile_count++;
+	}
 
+	chunk_set_cell(chunk, x, y, tile.texture_index, tile.tint);
+	chunk->revision++;
+	grid->revision++;
+}
 
-bool save_tilemap(const Tilemap* tilemap, const char* filepath)
+bool tile_grid_erase(TileGrid* grid, Vec2i index)
 {
-	if (!tilemap)
+	Vec2i position = get_chunk_position(index);
+	if (!grid || grid->size == 0)
 		return false;
 
-	FILE* output = fopen(filepath, "w");
-	if (!output)
-	{
-		fprintf(stderr, "Could not open %s: %s\n", filepath, strerror(errno)); 
+	size_t slot = tile_grid_find_slot(grid, position);
+	if (!grid->items[slot])
 		return false;
-	}
-
-	// TODO: check all return value
-	fwrite(MAGIC, 1, strlen(MAGIC), output);
-
-	// Offset
-	write_vector2(output, tilemap->offset);
 
-	// Main layer
-	write_layer(output, tilemap->main_layer);
+	int x = index.x - position.x * CHUNK_SIZE;
+	int y = index.y - position.y * CHUNK_SIZE;
+	if (!chunk_has_tile(grid->items[slot], x, y))
+		return false;
 
-	// Layers
-	fwrite(&tilemap->layers.size, sizeof(tilemap->layers.size), 1, output);
-	for (size_t i = 0; i < tilemap->layers.size; i++)
-		write_layer(output, tilemap->layers.items[i]);
+	Chunk* chunk = tile_grid_make_writable(grid, slot);
+	if (!chunk)
+		return false;
 
-	// Textures
-	fwrite(&tilemap->textures.size, sizeof(tilemap->textures.size), 1, output);
-	for (size_t i = 0; i < tilemap->textures.size; i++)
-		write_texture(output, tilemap->textures.items[i]);
+	chunk->occupied[y] &= ~(1u << x);
+	chunk->tile_count--;
+	chunk->revision++;
+	grid->tile_count--;
+	grid->revision++;
 
-	fclose(output);
+	if (chunk->tile_count == 0)
+		tile_grid_remove_chunk(grid, position);
 
 	return true;
 }
 
-static Vector2 read_vector2(FILE* file)
+void tile_grid_fill_row(TileGrid* grid, Vec2i start, int length, const Tile* tile)
 {
-	Vector2 result = {0};
-	if (!file)
-		return result;
+	if (!grid || length <= 0)
+		return;
+
+	int end = start.x + length;
+	int x = start.x;
+	while (x < end)
+	{
+		Vec2i position = get_chunk_position((Vec2i){ x, start.y });
+		int chunk_x = x - position.x * CHUNK_SIZE;
+		int chunk_y = start.y - position.y * CHUNK_SIZE;
+		int count = end - x < CHUNK_SIZE - chunk_x ? end - x : CHUNK_SIZE - chunk_x;
+		uint32_t bits = (count == CHUNK_SIZE ? UINT32_MAX : (1u << count) - 1) << chunk_x;
+		x += count;
+
+		Chunk* chunk = NULL;
+		if (tile)
+		{
+			chunk = tile_grid_add_chunk(grid, position);
+			if (!chunk)
+				return;
+
+			size_t added = count - __builtin_popcount(chunk->occupied[chunk_y] & bits);
+			chunk->occupied[chunk_y] |= bits;
+			chunk->tile_count += added;
+			grid->tile_count += added;
+
+			// The cells of the row share one palette entry
+			chunk_set_cell(chunk, chunk_x, chunk_y, tile->texture_index, tile->tint);
+			int cell = chunk_y * CHUNK_SIZE + chunk_x;
+			for (int i = cell + 1; i < cell + count; i++)
+			{
+				chunk->textures[i] = chunk->textures[cell];
+				chunk->tints[i] = chunk->tints[cell];
+			}
+		}
+		else
+		{
+			if (grid->size == 0)
+				return;
 
-	fread(&result.x, sizeof(result.x), 1, file);
-	fread(&result.y, sizeof(result.y), 1, file);
+			size_t slot = tile_grid_find_slot(grid, position);
+			if (!grid->items[slot] || (grid->items[slot]->occupied[chunk_y] & bits) == 0)
+				continue;
 
-	return result;
+			chunk = tile_grid_make_writable(grid, slot);
+			if (!chunk)
+				return;
+
+			size_t removed = __builtin_popcount(chunk->occupied[chunk_y] & bits);
+			chunk->occupied[chunk_y] &= ~bits;
+			chunk->tile_count -= removed;
+			grid->tile_count -= removed;
+		}
+
+		chunk->revision++;
+		grid->revision++;
+
+		if (chunk->tile_count == 0)
+			tile_grid_remove_chunk(grid, position);
+	}
 }
 
-static Vec2i read_vector2i(FILE* file)
+void tile_grid_free(TileGrid* grid)
 {
-	Vec2i result = {0};
-	if (!file)
-		return result;
+	if (!grid)
+		return;
 
-	fread(&result.x, sizeof(result.x), 1, file);
-	fread(&result.y, sizeof(result.y), 1, file);
+	for (size_t i = 0; i < grid->capacity; i++)
+	{
+		if (grid->items[i])
+			release_chunk(grid->items[i]);
+	}
 
-	return result;
+	free(grid->items);
+	grid->items = NULL;
+	grid->size = 0;
+	grid->capacity = 0;
+	grid->tile_count = 0;
 }
 
-static Rectangle read_rectangle(FILE* file)
+static Rectangle get_tile_rect(const Tilemap* tilemap, const Layer* layer, Tile tile, bool is_static)
 {
-	Rectangle result = {0};
-	if (!file)
+	if (is_static)
+	{
+		Rectangle result = tile.bounds;
+		result.x += tilemap->offset.x + layer->offset.x;
+		result.y += tilemap->offset.y + layer->offset.y;
+
 		return result;
+	}
 
-	fread(&result.x, sizeof(result.x), 1, file);
-	fread(&result.y, sizeof(result.y), 1, file);
-	fread(&result.width, sizeof(result.width), 1, file);
-	fread(&result.height, sizeof(result.height), 1, file);
+	Rectangle result =
+	{
+		.x = tilemap->offset.x + layer->offset.x + tile.tilemap_index.x,
+		.y = tilemap->offset.y + layer->offset.y + tile.tilemap_index.y,
+		.width = 1.0f,
+		.height = 1.0f,
+	};
 
 	return result;
 }
 
-static Color read_color(FILE* file)
+static void draw_tile(const Tilemap* tilemap, Tile tile, Rectangle dest)
 {
-	Color result = {0};
-	if (!file)
-		return result;
+	if (tile.texture_index >= tilemap->textures.size)
+		return;
 
-	fread(&result.r, sizeof(result.r), 1, file);
-	fread(&result.g, sizeof(result.g), 1, file);
-	fread(&result.b, sizeof(result.b), 1, file);
-	fread(&result.a, sizeof(result.a), 1, file);
+	// Every tile samples from a shared atlas page so raylib can batch consecutive draws
+	AtlasRegion region = tilemap->textures.items[tile.texture_index];
+	const Texture2D* texture = atlas_get_texture(&tilemap->atlas, region);
+	if (texture->id == 0)
+		return;
 
-	return result;
+	DrawTexturePro(*texture, region.source, dest, (Vector2){0.0f, 0.0f}, 0.0f, tile.tint);
 }
 
-static Tile read_tile(FILE* file, bool is_static)
+static void draw_chunk(const Tilemap* tilemap, const Layer* layer, const Chunk* chunk)
 {
-	Tile result = {0};
-	if (!file)
-		return result;
+	for (int y = 0; y < CHUNK_SIZE; y++)
+	{
+		uint32_t row = chunk->occupied[y];
+		for (int x = 0; row != 0; x++, row >>= 1)
+		{
+			if (!(row & 1u))
+				continue;
 
-	// tilemap_index;
-	// bounds;
-	if (is_static)
-		result.bounds = read_rectangle(file);
+			Tile tile = chunk_get_tile(chunk, x, y);
+			draw_tile(tilemap, tile, get_tile_rect(tilemap, layer, tile, false));
+		}
+	}
+}
+
+void get_visible_chunks(const TileGrid* grid, Rectangle area, VisibleChunks* result)
+{
+	Vec2i area_min = { (int)floorf(area.x), (int)floorf(area.y) };
+	Vec2i area_max = { (int)ceilf(area.x + area.width), (int)ceilf(area.y + area.height) };
+	Vec2i chunk_min = get_chunk_position(area_min);
+	Vec2i chunk_max = get_chunk_position(area_max);
+
+	// Look up the visible chunks when there are fewer of them than chunks in the grid,
+	// otherwise walk the directory and test each chunk
+	size_t visible_chunks = (size_t)(chunk_max.x - chunk_min.x + 1) * (size_t)(chunk_max.y - chunk_min.y + 1);
+	if (visible_chunks < grid->size)
+	{
+		for (int y = chunk_min.y; y <= chunk_max.y; y++)
+		{
+			for (int x = chunk_min.x; x <= chunk_max.x; x++)
+			{
+				const Chunk* chunk = tile_grid_get_chunk(grid, (Vec2i){x, y});
+				if (chunk)
+					da_append(*result, chunk);
+			}
+		}
+	}
 	else
-		result.tilemap_index = read_vector2i(file);
-	
-	// size_t texture_index;
-	fread(&result.texture_index, sizeof(result.texture_index), 1, file);
+	{
+		for (size_t i = 0; i < grid->capacity; i++)
+		{
+			const Chunk* chunk = grid->items[i];
+			if (!chunk)
+				continue;
 
-	// Color tint;
-	result.tint = read_color(file);
+			if (chunk->position.x < chunk_min.x || chunk->position.x > chunk_max.x ||
+				chunk->position.y < chunk_min.y || chunk->position.y > chunk_max.y)
+				continue;
 
-	return result;
+			da_append(*result, chunk);
+		}
+	}
 }
 
-static Layer read_layer(FILE* file)
+static void draw_layer(const Tilemap* tilemap, const Layer* layer, Rectangle view, TileRenderer* renderer)
 {
-	Layer result = {0};
-	if (!file)
-		return result;
+	Vector2 origin = { tilemap->offset.x + layer->offset.x, tilemap->offset.y + layer->offset.y };
 
-	// Offset;
-	result.offset = read_vector2(file);
+	// Visible area in layer space
+	Rectangle layer_view = view;
+	layer_view.x -= origin.x;
+	layer_view.y -= origin.y;
 
-	size_t amount;
-	// Tiles;
-	fread(&amount, sizeof(amount), 1, file);
-	for (size_t i = 0; i < amount; i++)
+	VisibleChunks chunks = {0};
+	get_visible_chunks(&layer->tiles, layer_view, &chunks);
+	if (renderer)
+		tile_renderer_draw_chunks(renderer, tilemap, origin, chunks.items, chunks.size);
+	else
 	{
-		Tile tile = read_tile(file, false);
-		da_append(result.tiles, tile);
+		for (size_t i = 0; i < chunks.size; i++)
+			draw_chunk(tilemap, layer, chunks.items[i]);
 	}
+	free(chunks.items);
 
-
-	// Static tiles;
-	fread(&amount, sizeof(amount), 1, file);
-	for (size_t i = 0; i < amount; i++)
+	// Static tiles
+	Indices visible = {0};
+	query_static_tiles(layer, layer_view, &visible);
+	size_t previous_page = SIZE_MAX;
+	for (size_t i = 0; i < visible.size; i++)
 	{
-		Tile tile = read_tile(file, true);
-		da_append(result.static_tiles, tile);
-	}
-
-	return result;
-}
+		Tile tile = layer->static_tiles.items[visible.items[i]];
+		if (tile.texture_index >= tilemap->textures.size)
+			continue;
 
-static Texture2D read_texture(FILE* file)
-{
-	Texture2D result = {0};
-	if (!file)
-		return result;
+		draw_tile(tilemap, tile, get_tile_rect(tilemap, layer, tile, true));
 
-	Image image = { .mipmaps = 1 };
-	fread(&image.width, sizeof(image.width), 1, file);
-	fread(&image.height, sizeof(image.height), 1, file);
-	fread(&image.format, sizeof(image.format), 1, file);
+		size_t page = tilemap->textures.items[tile.texture_index].page;
+		if (renderer && page != previous_page)
+		{
+			renderer->stats.draw_calls++;
+			renderer->stats.texture_binds++;
+			previous_page = page;
+		}
+	}
+	if (renderer)
+		renderer->stats.tiles_drawn += visible.size;
+	free(visible.items);
+}
 
-	size_t size = GetPixelDataSize(image.width, image.height, image.format);
-	image.data = malloc(size);
-	if (!image.data)
-		fprintf(stderr, "ERROR: Could not allocate enough space\n");
-	fread(image.data, size, 1, file);
 
-	result = LoadTextureFromImage(image);
+void draw_tilemap(const Tilemap* tilemap, Rectangle view, TileRenderer* renderer)
+{
+	for (size_t i = 0; i < tilemap->layers.size; i++)
+		draw_layer(tilemap, &tilemap->layers.items[i], view, renderer);
 
-	free(image.data);
+	draw_layer(tilemap, &tilemap->main_layer, view, renderer);
 
-	return result;
+	tile_renderer_end_frame(renderer);
 }
 
-Tilemap load_tilemap(const char* filepath)
+bool add_texture(Tilemap* tilemap, Image image)
 {
-	Tilemap result = {0};
+	if (!tilemap)
+		return false;
 
-	FILE* input = fopen(filepath, "r");
-	if (!input)
+	if (tilemap->textures.size >= TILEMAP_MAX_TEXTURES)
 	{
-		fprintf(stderr, "ERROR: Could not open %s: %s\n", filepath, strerror(errno)); 
-		return result;
+		fprintf(stderr, "ERROR: A tilemap can't hold more than %d textures\n", TILEMAP_MAX_TEXTURES);
+		return false;
 	}
 
-	char magic[5] = {0};
-	fread(magic, 1, strlen(MAGIC), input);
-	if (strcmp(magic, MAGIC) != 0)
+	AtlasRegion region;
+	if (!atlas_add_image(&tilemap->atlas, image, &region))
 	{
-		fprintf(stderr, "ERROR: The format of the file is not correct: expected magic: \"%s\", got \"%s\"\n", MAGIC, magic);
-		goto return_defer;
+		fprintf(stderr, "ERROR: Could not add a %dx%d image to the atlas\n", image.width, image.height);
+		return false;
 	}
 
-	// Offset
-	result.offset = read_vector2(input);
+	da_append(tilemap->textures, region);
+	tilemap->revision++;
+
+	return true;
+}
+
+typedef struct
+{
+	Image rgba;
+	const Rectangle* cells;
+	bool* transparent;
+} TransparentCells;
 
-	// Main layer
-	result.main_layer = read_layer(input);
+static void find_transparent_cell(void* context, size_t index)
+{
+	TransparentCells* job = context;
+	Rectangle cell = job->cells[index];
+	const Color* pixels = job->rgba.data;
 
-	size_t amount;
-	// Layers
-	fread(&amount, sizeof(amount), 1, input);
-	for (size_t i = 0; i < amount; i++)
+	bool transparent = true;
+	for (int y = (int)cell.y; y < (int)(cell.y + cell.height) && transparent; y++)
 	{
-		Layer layer = read_layer(input);
-		da_append(result.layers, layer);
+		const Color* row = pixels + (size_t)y * job->rgba.width;
+		for (int x = (int)cell.x; x < (int)(cell.x + cell.width); x++)
+		{
+			if (row[x].a != 0)
+			{
+				transparent = false;
+				break;
+			}
+		}
 	}
 
-	// Textures
-	fread(&amount, sizeof(amount), 1, input);
-	for (size_t i = 0; i < amount; i++)
+	job->transparent[index] = transparent;
+}
+
+bool import_tileset(const char* filepath, int width, int height, TilesetImport* result, ImportProgress progress, void* context)
+{
+	*result = (TilesetImport){0};
+
+	TRACE_BEGIN("load tileset image");
+	Image tileset = LoadImage(filepath);
+	TRACE_END();
+
+	if (!IsImageReady(tileset))
 	{
-		Texture2D texture = read_texture(input);
-		da_append(result.textures, texture);
+		fprintf(stderr, "ERROR: Failed to load image: %s\n", filepath);
+		return false;
 	}
-	
 
-return_defer:
-	fclose(input);
+	if (width <= 0 || height <= 0 || tileset.width % width != 0 || tileset.height % height != 0)
+	{
+		fprintf(stderr, "ERROR: tileset [%s] is not divisible in %dx%d tiles\n", filepath, width, height);
+		UnloadImage(tileset);
+		return false;
+	}
+
+	ImageFormat(&tileset, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+	int tile_width = tileset.width / width;
+	int tile_height = tileset.height / height;
+	size_t cell_count = (size_t)width * (size_t)height;
+
+	Rectangle* cells = malloc(IMPORT_BATCH_CELLS * sizeof(Rectangle));
+	bool* transparent = malloc(IMPORT_BATCH_CELLS * sizeof(bool));
+	result->name = strdup(GetFileName(filepath));
+	result->image = tileset;
+	bool success = cells && transparent && result->name;
+	if (!success)
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+
+	// Batches keep the progress moving, the cells of a batch are checked by parallel jobs
+	TRACE_BEGIN("slice tileset");
+	for (size_t first = 0; success && first < cell_count; first += IMPORT_BATCH_CELLS)
+	{
+		size_t count = cell_count - first < IMPORT_BATCH_CELLS ? cell_count - first : IMPORT_BATCH_CELLS;
+		for (size_t i = 0; i < count; i++)
+		{
+			size_t cell = first + i;
+			cells[i] = (Rectangle)
+			{
+				.x = (cell % width) * tile_width,
+				.y = (cell / width) * tile_height,
+				.width = tile_width,
+				.height = tile_height,
+			};
+		}
+
+		TransparentCells job = { .rgba = tileset, .cells = cells, .transparent = transparent };
+		parallel_for(count, find_transparent_cell, &job);
+
+		// Fully transparent cells would only be empty buttons in the tile selector
+		for (size_t i = 0; i < count; i++)
+		{
+			if (transparent[i])
+				result->skipped++;
+			else
+				da_append(result->tiles, cells[i]);
+		}
+
+		if (progress)
+			progress(context, (float)(first + count) / cell_count);
+	}
+	TRACE_END();
+
+	free(cells);
+	free(transparent);
+
+	if (!success)
+		unload_tileset_import(result);
+
+	return success;
+}
+
+bool add_tileset_import(Tilemap* tilemap, TilesetImport* import)
+{
+	if (!tilemap || !import)
+		return false;
+
+	size_t count = import->tiles.size;
+	if (count > TILEMAP_MAX_TEXTURES - tilemap->textures.size)
+	{
+		fprintf(stderr, "ERROR: A tilemap can't hold more than %d textures\n", TILEMAP_MAX_TEXTURES);
+		unload_tileset_import(import);
+		return false;
+	}
+
+	// The tiles are packed after the ones already there, sharing their pages
+	size_t first_texture = tilemap->textures.size;
+	da_reserve(tilemap->textures, first_texture + count);
+	if (!atlas_add_image_areas(&tilemap->atlas, import->image, import->tiles.items, count, tilemap->textures.items + first_texture))
+	{
+		fprintf(stderr, "ERROR: Could not add the tiles of [%s] to the atlas\n", import->name);
+		unload_tileset_import(import);
+		return false;
+	}
+	tilemap->textures.size += count;
+
+	if (count > 0)
+	{
+		add_tileset_range(tilemap, import->name, first_texture);
+		tilemap->revision++;
+	}
+
+	unload_tileset_import(import);
+	return true;
+}
+
+void unload_tileset_import(TilesetImport* import)
+{
+	if (!import)
+		return;
+
+	free(import->name);
+	UnloadImage(import->image);
+	free(import->tiles.items);
+	*import = (TilesetImport){0};
+}
+
+void add_tileset(Tilemap* tilemap, const char* filepath, int width, int height)
+{
+	TilesetImport import;
+	if (import_tileset(filepath, width, height, &import, NULL, NULL))
+		add_tileset_import(tilemap, &import);
+}
+
+void add_tileset_range(Tilemap* tilemap, const char* name, size_t first_texture)
+{
+	if (!tilemap || first_texture >= tilemap->textures.size)
+		return;
+
+	Tileset tileset =
+	{
+		.name = strdup(name ? name : ""),
+		.first_texture = first_texture,
+		.texture_count = tilemap->textures.size - first_texture,
+	};
+	if (!tileset.name)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return;
+	}
+
+	da_append(tilemap->tilesets, tileset);
+}
+
+// Value of removed textures in a remap table
+#define TEXTURE_REMOVED SIZE_MAX
+// Chunk directory slots rewritten by one job of remove_textures
+#define REMAP_SLOTS_PER_JOB 1024
+
+typedef struct
+{
+	TileGrid* grid;
+	size_t first_slot;
+	size_t end_slot;
+	size_t removed_tiles;
+} RemapRange;
+
+typedef struct
+{
+	const size_t* remap; // New index of every texture, or TEXTURE_REMOVED
+	const bool* moved; // Textures whose region moved in the atlas, their meshes are stale
+	size_t texture_count;
+	RemapRange* ranges;
+} RemapJob;
+
+static void remap_chunk_range(void* context, size_t index)
+{
+	const RemapJob* job = context;
+	RemapRange* range = &job->ranges[index];
+
+	for (size_t slot = range->first_slot; slot < range->end_slot; slot++)
+	{
+		// Only chunks with a tile that changes are written, the others stay shared with snapshots
+		const Chunk* shared = range->grid->items[slot];
+		if (!shared)
+			continue;
+
+		bool changes = false;
+		for (int y = 0; y < CHUNK_SIZE && !changes; y++)
+		{
+			for (uint32_t bits = shared->occupied[y]; bits && !changes; bits &= bits - 1)
+			{
+				size_t texture_index = shared->textures[y * CHUNK_SIZE + __builtin_ctz(bits)];
+				changes = texture_index < job->texture_count &&
+					(job->remap[texture_index] != texture_index || job->moved[texture_index]);
+			}
+		}
+		if (!changes)
+			continue;
+
+		// Every job has its own slots, so making copies doesn't race
+		Chunk* chunk = tile_grid_make_writable(range->grid, slot);
+		if (!chunk)
+			continue;
+
+		for (int y = 0; y < CHUNK_SIZE; y++)
+		{
+			for (uint32_t bits = chunk->occupied[y]; bits; bits &= bits - 1)
+			{
+				int x = __builtin_ctz(bits);
+				uint16_t* texture_index = &chunk->textures[y * CHUNK_SIZE + x];
+				if (*texture_index >= job->texture_count)
+					continue;
+
+				size_t new_index = job->remap[*texture_index];
+				if (new_index == TEXTURE_REMOVED)
+				{
+					chunk->occupied[y] &= ~(1u << x);
+					chunk->tile_count--;
+					range->removed_tiles++;
+				}
+				else
+					*texture_index = new_index;
+			}
+		}
+		chunk->revision++;
+	}
+}
+
+static void remap_static_tiles(Layer* layer, const size_t* remap, size_t texture_count)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < layer->static_tiles.size; i++)
+	{
+		Tile tile = layer->static_tiles.items[i];
+		if (tile.texture_index < texture_count)
+		{
+			if (remap[tile.texture_index] == TEXTURE_REMOVED)
+				continue;
+			tile.texture_index = remap[tile.texture_index];
+		}
+
+		layer->static_tiles.items[kept++] = tile;
+	}
+
+	if (kept == layer->static_tiles.size)
+		return;
+
+	layer->static_tiles.size = kept;
+	rebuild_static_index(layer);
+}
+
+static void remove_empty_chunks(TileGrid* grid)
+{
+	// Collected first so the directory doesn't shift while walking it
+	struct
+	{
+		Vec2i* items;
+		size_t size;
+		size_t capacity;
+	} empty_chunks = {0};
+
+	for (size_t i = 0; i < grid->capacity; i++)
+	{
+		if (grid->items[i] && grid->items[i]->tile_count == 0)
+			da_append(empty_chunks, grid->items[i]->position);
+	}
+
+	for (size_t i = 0; i < empty_chunks.size; i++)
+		tile_grid_remove_chunk(grid, empty_chunks.items[i]);
+	free(empty_chunks.items);
+}
+
+void remove_texture(Tilemap* tilemap, size_t texture_index)
+{
+	remove_textures(tilemap, &texture_index, 1);
+}
+
+void remove_textures(Tilemap* tilemap, const size_t* texture_indices, size_t count)
+{
+	if (!tilemap || tilemap->textures.size == 0 || count == 0)
+		return;
+
+	size_t texture_count = tilemap->textures.size;
+	size_t* remap = malloc(texture_count * sizeof(size_t));
+	if (!remap)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return;
+	}
+
+	for (size_t i = 0; i < texture_count; i++)
+		remap[i] = i;
+
+	bool any = false;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (texture_indices[i] < texture_count)
+		{
+			remap[texture_indices[i]] = TEXTURE_REMOVED;
+			any = true;
+		}
+	}
+	if (!any)
+	{
+		free(remap);
+		return;
+	}
+
+	size_t next = 0;
+	for (size_t i = 0; i < texture_count; i++)
+	{
+		if (remap[i] != TEXTURE_REMOVED)
+			remap[i] = next++;
+	}
+
+	// The atlas frees the area of the removed textures, the chunks using a texture that moved are
+	// rewritten with the renumbered ones
+	bool* moved = calloc(texture_count, sizeof(bool));
+	AtlasRegion* regions = malloc(texture_count * sizeof(AtlasRegion));
+	if (!moved || !regions)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		free(moved);
+		free(regions);
+		free(remap);
+		return;
+	}
+
+	for (size_t i = 0; i < texture_count; i++)
+	{
+		if (remap[i] != TEXTURE_REMOVED)
+			regions[remap[i]] = tilemap->textures.items[i];
+	}
+
+	if (atlas_repack(&tilemap->atlas, regions, next))
+	{
+		for (size_t i = 0; i < texture_count; i++)
+		{
+			if (remap[i] == TEXTURE_REMOVED)
+				continue;
+
+			AtlasRegion before = tilemap->textures.items[i];
+			AtlasRegion after = regions[remap[i]];
+			moved[i] = before.page != after.page || before.source.x != after.source.x || before.source.y != after.source.y;
+		}
+	}
+
+	// Grid tiles: every layer is split in ranges of directory slots, rewritten in parallel
+	size_t layer_count = tilemap->layers.size + 1;
+	struct
+	{
+		RemapRange* items;
+		size_t size;
+		size_t capacity;
+	} ranges = {0};
+
+	for (size_t i = 0; i < layer_count; i++)
+	{
+		TileGrid* grid = i == 0 ? &tilemap->main_layer.tiles : &tilemap->layers.items[i - 1].tiles;
+		for (size_t slot = 0; slot < grid->capacity; slot += REMAP_SLOTS_PER_JOB)
+		{
+			size_t end_slot = slot + REMAP_SLOTS_PER_JOB < grid->capacity ? slot + REMAP_SLOTS_PER_JOB : grid->capacity;
+			RemapRange range = { .grid = grid, .first_slot = slot, .end_slot = end_slot };
+			da_append(ranges, range);
+		}
+	}
+
+	RemapJob job = { .remap = remap, .moved = moved, .texture_count = texture_count, .ranges = ranges.items };
+	parallel_for(ranges.size, remap_chunk_range, &job);
+
+	for (size_t i = 0; i < ranges.size; i++)
+		ranges.items[i].grid->tile_count -= ranges.items[i].removed_tiles;
+	free(ranges.items);
+
+	for (size_t i = 0; i < layer_count; i++)
+	{
+		Layer* layer = i == 0 ? &tilemap->main_layer : &tilemap->layers.items[i - 1];
+		remove_empty_chunks(&layer->tiles);
+		layer->tiles.revision++;
+		remap_static_tiles(layer, remap, texture_count);
+	}
+
+	memcpy(tilemap->textures.items, regions, next * sizeof(AtlasRegion));
+	tilemap->textures.size = next;
+	free(regions);
+	free(moved);
+
+	// Tilesets keep the textures left, empty ones go away
+	size_t kept = 0;
+	for (size_t i = 0; i < tilemap->tilesets.size; i++)
+	{
+		Tileset tileset = tilemap->tilesets.items[i];
+		size_t first = TEXTURE_REMOVED;
+		size_t left = 0;
+		for (size_t j = tileset.first_texture; j < tileset.first_texture + tileset.texture_count && j < texture_count; j++)
+		{
+			if (remap[j] == TEXTURE_REMOVED)
+				continue;
+			if (first == TEXTURE_REMOVED)
+				first = remap[j];
+			left++;
+		}
+
+		if (left == 0)
+		{
+			free(tileset.name);
+			continue;
+		}
+
+		tileset.first_texture = first;
+		tileset.texture_count = left;
+		tilemap->tilesets.items[kept++] = tileset;
+	}
+	tilemap->tilesets.size = kept;
+
+	free(remap);
+	tilemap->revision++;
+}
+
+void remove_tileset(Tilemap* tilemap, size_t tileset_index)
+{
+	if (!tilemap || tileset_index >= tilemap->tilesets.size)
+		return;
+
+	Tileset tileset = tilemap->tilesets.items[tileset_index];
+	size_t* indices = malloc(tileset.texture_count * sizeof(size_t));
+	if (!indices)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return;
+	}
+
+	for (size_t i = 0; i < tileset.texture_count; i++)
+		indices[i] = tileset.first_texture + i;
+
+	remove_textures(tilemap, indices, tileset.texture_count);
+	free(indices);
+}
+
+size_t remove_unused_textures(Tilemap* tilemap)
+{
+	if (!tilemap || tilemap->textures.size == 0)
+		return 0;
+
+	size_t texture_count = tilemap->textures.size;
+	bool* used = calloc(texture_count, sizeof(bool));
+	size_t* unused = malloc(texture_count * sizeof(size_t));
+	if (!used || !unused)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		free(used);
+		free(unused);
+		return 0;
+	}
+
+	for (size_t i = 0; i < tilemap->layers.size + 1; i++)
+	{
+		const Layer* layer = i == 0 ? &tilemap->main_layer : &tilemap->layers.items[i - 1];
+		for (size_t slot = 0; slot < layer->tiles.capacity; slot++)
+		{
+			const Chunk* chunk = layer->tiles.items[slot];
+			if (!chunk)
+				continue;
+
+			for (int y = 0; y < CHUNK_SIZE; y++)
+			{
+				for (uint32_t bits = chunk->occupied[y]; bits; bits &= bits - 1)
+				{
+					size_t texture_index = chunk->textures[y * CHUNK_SIZE + __builtin_ctz(bits)];
+					if (texture_index < texture_count)
+						used[texture_index] = true;
+				}
+			}
+		}
+
+		for (size_t j = 0; j < layer->static_tiles.size; j++)
+		{
+			if (layer->static_tiles.items[j].texture_index < texture_count)
+				used[layer->static_tiles.items[j].texture_index] = true;
+		}
+	}
+
+	size_t unused_count = 0;
+	for (size_t i = 0; i < texture_count; i++)
+	{
+		if (!used[i])
+			unused[unused_count++] = i;
+	}
+
+	remove_textures(tilemap, unused, unused_count);
+
+	free(used);
+	free(unused);
+	return unused_count;
+}
+
+size_t merge_layers(Tilemap* tilemap)
+{
+	if (!tilemap)
+		return 0;
+
+	// The main layer is drawn last, layers go in from the top one down, under what is already there
+	Layer* main_layer = &tilemap->main_layer;
+	size_t merged = 0;
+	while (merged < tilemap->layers.size)
+	{
+		Layer* layer = &tilemap->layers.items[tilemap->layers.size - 1 - merged];
+		float shift_x = layer->offset.x - main_layer->offset.x;
+		float shift_y = layer->offset.y - main_layer->offset.y;
+		if (shift_x != floorf(shift_x) || shift_y != floorf(shift_y))
+			break;
+
+		// They are drawn over the grid of their layer, in the main layer they would end up over its grid
+		if (layer->static_tiles.size > 0)
+			break;
+
+		Vec2i shift = { (int)shift_x, (int)shift_y };
+		for (size_t slot = 0; slot < layer->tiles.capacity; slot++)
+		{
+			const Chunk* chunk = layer->tiles.items[slot];
+			if (!chunk)
+				continue;
+
+			for (int y = 0; y < CHUNK_SIZE; y++)
+			{
+				for (uint32_t bits = chunk->occupied[y]; bits; bits &= bits - 1)
+				{
+					Tile tile = chunk_get_tile(chunk, __builtin_ctz(bits), y);
+					tile.tilemap_index.x += shift.x;
+					tile.tilemap_index.y += shift.y;
+					if (!tile_grid_get(&main_layer->tiles, tile.tilemap_index, NULL))
+						tile_grid_set(&main_layer->tiles, tile);
+				}
+			}
+		}
+
+		unload_layer(layer);
+		merged++;
+	}
+
+	// Layers left are the bottom ones, they keep their order under the main layer
+	tilemap->layers.size -= merged;
+
+	return merged;
+}
+
+uint64_t get_tilemap_revision(const Tilemap* tilemap)
+{
+	if (!tilemap)
+		return 0;
+
+	// Every counter only grows, so the sum changes whenever one of them does
+	uint64_t result = tilemap->revision + tilemap->atlas.revision + tilemap->layers.size;
+	result += tilemap->main_layer.tiles.revision + tilemap->main_layer.static_index.revision;
+	for (size_t i = 0; i < tilemap->layers.size; i++)
+		result += tilemap->layers.items[i].tiles.revision + tilemap->layers.items[i].static_index.revision;
+
+	return result;
+}
+
+uint64_t get_tilemap_structure_revision(const Tilemap* tilemap)
+{
+	if (!tilemap)
+		return 0;
+
+	uint64_t result = tilemap->revision + tilemap->layers.size;
+
+	result += tilemap->main_layer.static_index.revision;
+	for (size_t i = 0; i < tilemap->layers.size; i++)
+		result += tilemap->layers.items[i].static_index.revision;
+
 	return result;
 }
+
+static void clear_tilesets(Tilesets* tilesets)
+{
+	for (size_t i = 0; i < tilesets->size; i++)
+		free(tilesets->items[i].name);
+	tilesets->size = 0;
+}
+
+void unload_tileset(Tilemap* tilemap)
+{
+	atlas_unload(&tilemap->atlas);
+	tilemap->textures.size = 0;
+	clear_tilesets(&tilemap->tilesets);
+}
+
+void unload_layer(Layer* layer)
+{
+	// Vector2 offset;
+	layer->offset = (Vector2){0.0f, 0.0f};
+
+	// TileGrid tiles;
+	tile_grid_free(&layer->tiles);
+
+	// Tiles static_tiles;
+	free(layer->static_tiles.items);
+	layer->static_tiles.size = 0;
+	layer->static_tiles.capacity = 0;
+
+	// StaticIndex static_index;
+	unload_static_index(&layer->static_index);
+}
+
+void unload_tilemap(Tilemap* tilemap)
+{
+	// Offset
+	tilemap->offset = (Vector2){0.0f, 0.0f};
+
+	// main_layer;
+	unload_layer(&tilemap->main_layer);
+	
+	// layers;
+	for (size_t i = 0; i < tilemap->layers.size; i++)
+		unload_layer(&tilemap->layers.items[i]);
+	free(tilemap->layers.items);
+	tilemap->layers.capacity = 0;
+	tilemap->layers.size = 0;
+
+	// Textures
+	unload_tileset(tilemap);
+	free(tilemap->textures.items);
+	tilemap->textures.capacity = 0;
+	free(tilemap->tilesets.items);
+	tilemap->tilesets = (Tilesets){0};
+}
+
+static bool snapshot_tile_grid(const TileGrid* grid, TileGrid* result)
+{
+	*result = *grid;
+	if (grid->capacity == 0)
+		return true;
+
+	result->items = malloc(grid->capacity * sizeof(Chunk*));
+	if (!result->items)
+	{
+		*result = (TileGrid){0};
+		return false;
+	}
+
+	for (size_t i = 0; i < grid->capacity; i++)
+	{
+		result->items[i] = grid->items[i];
+		if (grid->items[i])
+			atomic_fetch_add(&grid->items[i]->shares, 1);
+	}
+
+	return true;
+}
+
+static bool snapshot_layer(const Layer* layer, Layer* result)
+{
+	*result = (Layer){ .offset = layer->offset };
+	if (!snapshot_tile_grid(&layer->tiles, &result->tiles))
+		return false;
+
+	// Static tiles are few, a copy is cheap; the snapshot has no static index
+	if (layer->static_tiles.size > 0)
+	{
+		da_reserve(result->static_tiles, layer->static_tiles.size);
+		if (!result->static_tiles.items)
+			return false;
+
+		memcpy(result->static_tiles.items, layer->static_tiles.items, layer->static_tiles.size * sizeof(Tile));
+		result->static_tiles.size = layer->static_tiles.size;
+	}
+
+	return true;
+}
+
+bool snapshot_tilemap(const Tilemap* tilemap, Tilemap* result)
+{
+	*result = (Tilemap){ .offset = tilemap->offset, .revision = tilemap->revision };
+	result->atlas = atlas_share(&tilemap->atlas);
+
+	// A part missing would be saved as empty, so any failure fails the whole snapshot
+	bool success = snapshot_layer(&tilemap->main_layer, &result->main_layer);
+	da_reserve(result->layers, tilemap->layers.size);
+	success = success && (tilemap->layers.size == 0 || result->layers.items);
+	for (size_t i = 0; success && i < tilemap->layers.size; i++)
+		success = snapshot_layer(&tilemap->layers.items[i], &result->layers.items[result->layers.size++]);
+
+	if (success && tilemap->textures.size > 0)
+	{
+		da_reserve(result->textures, tilemap->textures.size);
+		success = result->textures.items != NULL;
+		if (success)
+		{
+			memcpy(result->textures.items, tilemap->textures.items, tilemap->textures.size * sizeof(AtlasRegion));
+			result->textures.size = tilemap->textures.size;
+		}
+	}
+
+	for (size_t i = 0; success && i < tilemap->tilesets.size; i++)
+	{
+		Tileset tileset = tilemap->tilesets.items[i];
+		tileset.name = strdup(tileset.name);
+		success = tileset.name != NULL;
+		if (success)
+			da_append(result->tilesets, tileset);
+	}
+
+	if (!success)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		unload_tilemap_snapshot(result);
+		*result = (Tilemap){0};
+	}
+
+	return success;
+}
+
+void unload_tilemap_snapshot(Tilemap* snapshot)
+{
+	unload_layer(&snapshot->main_layer);
+	for (size_t i = 0; i < snapshot->layers.size; i++)
+		unload_layer(&snapshot->layers.items[i]);
+	free(snapshot->layers.items);
+
+	atlas_release(&snapshot->atlas);
+	free(snapshot->textures.items);
+	clear_tilesets(&snapshot->tilesets);
+	free(snapshot->tilesets.items);
+
+	*snapshot = (Tilemap){0};
+}
+
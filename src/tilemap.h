@@ -1,21 +1,31 @@
 #pragma once
 
 #include <raylib.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "atlas.h"
 
 typedef struct
 {
 	int x, y;
 } Vec2i;
 
+// Where the texture_index of a tile lives in the atlas
 typedef struct
 {
-	Texture2D* items;
+	AtlasRegion* items;
 	size_t size;
 	size_t capacity;
-} Textures2D;
+} TileTextures;
+
 
+// Tilemaps hold fewer textures than this so grid cells can store texture indices in 16 bits.
+// Cells store larger (invalid) indices as TILEMAP_MAX_TEXTURES, which stays invalid.
+#define TILEMAP_MAX_TEXTURES UINT16_MAX
 
+// Static tiles as they are stored, and grid cells as they are read and written
 typedef struct
 {
 	union
@@ -27,7 +37,6 @@ typedef struct
 	Color tint;
 } Tile;
 
-// TODO: Make into a hash_map<Vec2i, Tile>
 typedef struct
 {
 	Tile* items;
@@ -35,11 +44,85 @@ typedef struct
 	size_t capacity;
 } Tiles;
 
+// Grid tiles are stored in square chunks of CHUNK_SIZE x CHUNK_SIZE cells
+#define CHUNK_SIZE 32
+// Distinct tints a chunk can hold, cells store an index into the palette of their chunk. Past that
+// a new tint is stored as the closest one of the palette.
+#define CHUNK_TINTS 256
+
+typedef struct
+{
+	Vec2i position; // In chunks, the first cell is position * CHUNK_SIZE
+	uint64_t id; // Unique for the lifetime of the program
+	uint32_t revision; // Incremented on every change
+	// Owners besides the grid (snapshots), a shared chunk is copied before it is changed
+	atomic_uint shares;
+	size_t tile_count;
+	uint32_t occupied[CHUNK_SIZE]; // One bit per cell, one word per row
+	// Cell (x, y) is at [y * CHUNK_SIZE + x], its position is implicit
+	uint16_t textures[CHUNK_SIZE * CHUNK_SIZE];
+	uint8_t tints[CHUNK_SIZE * CHUNK_SIZE]; // Into tint_palette
+	int tint_count;
+	Color tint_palette[CHUNK_TINTS];
+} Chunk;
+
+// Chunk directory: open addressing hash map<Vec2i, Chunk*> keyed on chunk position
+// (linear probing, capacity is a power of two, empty slots are NULL)
+typedef struct
+{
+	Chunk** items;
+	size_t size; // Number of chunks
+	size_t capacity;
+	size_t tile_count;
+	uint64_t revision; // Incremented whenever a tile is added, removed or changed
+} TileGrid;
+
+typedef struct
+{
+	const Chunk** items;
+	size_t size;
+	size_t capacity;
+} VisibleChunks;
+
+typedef struct
+{
+	size_t* items;
+	size_t size;
+	size_t capacity;
+} Indices;
+
+// Static tiles are binned in squares of STATIC_BIN_SIZE x STATIC_BIN_SIZE world units
+#define STATIC_BIN_SIZE 8.0f
+// Tiles covering more bins than this are kept in a separate list that is always tested
+#define STATIC_MAX_BINS_PER_TILE 64
+
+typedef struct
+{
+	Vec2i position; // In bins
+	Indices tiles; // Order keys of the tiles overlapping the bin
+} StaticBin;
+
+// Spatial index over static tiles: open addressing hash map<Vec2i, StaticBin*>
+// (linear probing, capacity is a power of two, empty slots are NULL).
+// Bins hold order keys rather than indices into static_tiles, so removing a tile only touches the
+// bins it covers: the keys of the later tiles don't change when they move down.
+typedef struct
+{
+	StaticBin** items;
+	size_t size;
+	size_t capacity;
+	Indices orders; // Order key of every static tile, increasing like static_tiles
+	Indices large_tiles; // Order keys
+	uint64_t revision; // Incremented whenever a static tile is added or removed
+} StaticIndex;
+
 typedef struct
 {
 	Vector2 offset;
-	Tiles tiles;
+	TileGrid tiles;
+	// Change through add_static_tile/remove_static_tile or rebuild the index afterwards
 	Tiles static_tiles;
+	StaticIndex static_index;
 } Layer;
 
 typedef struct
@@ -49,25 +132,145 @@ typedef struct
 	size_t capacity;
 } Layers;
 
+// Textures added together by add_tileset, they are consecutive in TileTextures.
+// Fully transparent tiles of the image are not part of it.
+typedef struct
+{
+	char* name; // File name of the tileset image
+	size_t first_texture;
+	size_t texture_count;
+} Tileset;
+
+typedef struct
+{
+	Tileset* items;
+	size_t size;
+	size_t capacity;
+} Tilesets;
+
 typedef struct
 {
 	Vector2 offset;
 	Layer main_layer;
 	Layers layers;
 
-	Textures2D textures;
+	Atlas atlas;
+	TileTextures textures;
+	Tilesets tilesets; // Textures of no tileset (added one by one) are in none of them
+
+	uint64_t revision; // Incremented when textures are added or removed
 } Tilemap;
 
+size_t hash_vec2i(Vec2i value);
+bool vec2i_equals(Vec2i a, Vec2i b);
+
+Vec2i get_chunk_position(Vec2i tilemap_index);
+bool chunk_has_tile(const Chunk* chunk, int x, int y);
+// Cell (x, y) of the chunk as a Tile, whether it is occupied or not
+Tile chunk_get_tile(const Chunk* chunk, int x, int y);
+// Writes cell (x, y), occupied and the counts are left to the caller
+void chunk_set_cell(Chunk* chunk, int x, int y, size_t texture_index, Color tint);
+// Returns NULL if there is no chunk at the given position (in chunks)
+const Chunk* tile_grid_get_chunk(const TileGrid* grid, Vec2i position);
+// Returns the chunk at the given position ready to be changed, adding an empty one if there is none
+// (NULL on failure). Changes must keep occupied, the tile counts and the revisions up to date.
+Chunk* tile_grid_add_chunk(TileGrid* grid, Vec2i position);
+
+// Appends the chunks overlapping area (layer space) to result
+void get_visible_chunks(const TileGrid* grid, Rectangle area, VisibleChunks* result);
+
+// Returns false if there is no tile at the given index, otherwise copies it to *result (may be NULL)
+bool tile_grid_get(const TileGrid* grid, Vec2i index, Tile* result);
+// Inserts the tile or replaces the one with the same tilemap_index
+void tile_grid_set(TileGrid* grid, Tile tile);
+// Returns false if there was no tile at the given index
+bool tile_grid_erase(TileGrid* grid, Vec2i index);
+// Sets (tile is not NULL, its tilemap_index is ignored) or erases length cells of the row starting
+// at start, a chunk row at a time
+void tile_grid_fill_row(TileGrid* grid, Vec2i start, int length, const Tile* tile);
+// Reserves space in the chunk directory for the given amount of chunks
+void tile_grid_reserve(TileGrid* grid, size_t amount);
+void tile_grid_free(TileGrid* grid);
+
+typedef struct
+{
+	Rectangle* items;
+	size_t size;
+	size_t capacity;
+} TileAreas;
+
+// Tileset image sliced in tiles, ready to be copied into the atlas of a tilemap
+typedef struct
+{
+	char* name; // File name of the tileset image
+	Image image; // R8G8B8A8
+	TileAreas tiles; // Areas of the image holding the kept tiles, in row order
+	size_t skipped; // Fully transparent tiles, they are left out
+} TilesetImport;
+
+// Cells checked between two progress reports of import_tileset
+#define IMPORT_BATCH_CELLS 256
+
+// Called with the fraction of the cells done so far, on the thread running import_tileset
+typedef void (*ImportProgress)(void* context, float progress);
+
+// Loads and slices a tileset image in width x height tiles. Touches no GPU resources or tilemap,
+// so it can run on any thread. progress may be NULL.
+bool import_tileset(const char* filepath, int width, int height, TilesetImport* result, ImportProgress progress, void* context);
+// Copies the tiles of the import into the pages of the tilemap as a new tileset and unloads the
+// import. Returns false, discarding them, when they would go past TILEMAP_MAX_TEXTURES.
+bool add_tileset_import(Tilemap* tilemap, TilesetImport* import);
+void unload_tileset_import(TilesetImport* import);
+
+// Imports and adds the tileset in one go
 void add_tileset(Tilemap* tilemap, const char* filepath, int width, int height);
 
+// Adds a copy of the image to the atlas as a new texture_index, false past TILEMAP_MAX_TEXTURES
+bool add_texture(Tilemap* tilemap, Image image);
+
+// Adds a tileset of the given name covering the textures from first_texture to the last one
+void add_tileset_range(Tilemap* tilemap, const char* name, size_t first_texture);
+
 // This function will remove all tiles that use the given texture
 void remove_texture(Tilemap* tilemap, size_t texture_index);
+// Removes the textures and every tile using them, the later textures move down to fill the gaps.
+// All layers are rewritten once, whatever the number of textures. Their atlas area is freed: the
+// pages that held them are packed again and have to be uploaded again.
+void remove_textures(Tilemap* tilemap, const size_t* texture_indices, size_t count);
+// Removes every texture of tilesets.items[tileset_index]
+void remove_tileset(Tilemap* tilemap, size_t tileset_index);
+// Removes the textures no tile uses, returns how many there were
+size_t remove_unused_textures(Tilemap* tilemap);
+
+// Moves the layers into the main layer from the topmost one down, keeping the picture: their cells
+// only fill the cells still empty above them. Returns how many were merged. Merging stops at the
+// first layer whose offset from the main layer isn't a whole number of cells (grid tiles can only
+// move by whole cells) or that has static tiles (they would end up over the main grid), it and the
+// layers under it stay.
+size_t merge_layers(Tilemap* tilemap);
 
-void draw_tilemap(const Tilemap* tilemap);
+typedef struct TileRenderer TileRenderer;
+
+// view is the visible area in world space, chunks outside of it are skipped
+// Grid tiles go through the cached chunk meshes of renderer, or DrawTexturePro when it is NULL
+void draw_tilemap(const Tilemap* tilemap, Rectangle view, TileRenderer* renderer);
+
+// Changes whenever something that affects how the tilemap looks changes
+uint64_t get_tilemap_revision(const Tilemap* tilemap);
+// Changes on everything but grid tile edits (textures, static tiles), which the journal can't record
+uint64_t get_tilemap_structure_revision(const Tilemap* tilemap);
 
 void unload_tileset(Tilemap* tilemap);
 void unload_layer(Layer* layer);
 void unload_tilemap(Tilemap* tilemap);
 
+// Read only copy of the tilemap for saving on another thread while editing goes on.
+// Chunks are shared and copied on write, atlas pages are shared, the rest is copied.
+// Returns false, with nothing to unload, when a part could not be copied.
+bool snapshot_tilemap(const Tilemap* tilemap, Tilemap* result);
+// Safe on any thread, never touches GPU resources
+void unload_tilemap_snapshot(Tilemap* snapshot);
+
+// Implemented in tilemap_file.c, see tilemap_file.h for the format
 bool save_tilemap(const Tilemap* tilemap, const char* filepath);
 Tilemap load_tilemap(const char* filepath);
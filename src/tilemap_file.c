@@ -0,0 +1,1690 @@
+#include "tilemap_file.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <raylib.h>
+
+#include "tilemap.h"
+#include "static_index.h"
+#include "parallel.h"
+#include "qoi.h"
+#include "trace.h"
+#include "utils.h"
+
+// Size of a chunk in the file before its cells
+#define CHUNK_HEADER_SIZE (8 + 4 * CHUNK_SIZE)
+#define CELL_SIZE 8
+#define STATIC_TILE_SIZE 24
+#define TEXTURE_HEADER_SIZE 24
+
+// Highest version number still treated as a v2 style header, v1 files have the bits of
+// a float there and small values would be denormals, which were never written as offsets
+#define MAX_KNOWN_VERSION_BITS 0xff
+
+// ----------------------------------------------------------------------------
+// Little endian encoding
+
+static bool buffer_reserve(ByteBuffer* buffer, size_t amount)
+{
+	if (buffer->error)
+		return false;
+	if (buffer->size + amount <= buffer->capacity)
+		return true;
+
+	size_t capacity = buffer->capacity == 0 ? 4096 : buffer->capacity;
+	while (buffer->size + amount > capacity)
+		capacity *= 2;
+
+	uint8_t* items = realloc(buffer->items, capacity);
+	if (!items)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		buffer->error = true;
+		return false;
+	}
+
+	buffer->items = items;
+	buffer->capacity = capacity;
+	return true;
+}
+
+static void put_bytes(ByteBuffer* buffer, const void* data, size_t size)
+{
+	if (!buffer_reserve(buffer, size))
+		return;
+
+	memcpy(buffer->items + buffer->size, data, size);
+	buffer->size += size;
+}
+
+static void put_u32(ByteBuffer* buffer, uint32_t value)
+{
+	uint8_t bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+	put_bytes(buffer, bytes, sizeof(bytes));
+}
+
+static void put_u64(ByteBuffer* buffer, uint64_t value)
+{
+	put_u32(buffer, (uint32_t)value);
+	put_u32(buffer, (uint32_t)(value >> 32));
+}
+
+static void put_f32(ByteBuffer* buffer, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	put_u32(buffer, bits);
+}
+
+static void put_color(ByteBuffer* buffer, Color color)
+{
+	uint8_t bytes[4] = { color.r, color.g, color.b, color.a };
+	put_bytes(buffer, bytes, sizeof(bytes));
+}
+
+// Bounds checked reads of a section, out of bounds reads return 0 and set error
+typedef struct
+{
+	const uint8_t* data;
+	size_t size;
+	size_t position;
+	bool error;
+} Reader;
+
+static const uint8_t* get_bytes(Reader* reader, size_t size)
+{
+	if (reader->error || size > reader->size - reader->position)
+	{
+		reader->error = true;
+		return NULL;
+	}
+
+	const uint8_t* result = reader->data + reader->position;
+	reader->position += size;
+	return result;
+}
+
+static uint32_t read_u32_le(const uint8_t* bytes)
+{
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static float read_f32_le(const uint8_t* bytes)
+{
+	uint32_t bits = read_u32_le(bytes);
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+static uint32_t get_u32(Reader* reader)
+{
+	const uint8_t* bytes = get_bytes(reader, 4);
+	return bytes ? read_u32_le(bytes) : 0;
+}
+
+static uint64_t get_u64(Reader* reader)
+{
+	uint64_t low = get_u32(reader);
+	uint64_t high = get_u32(reader);
+	return low | (high << 32);
+}
+
+static float get_f32(Reader* reader)
+{
+	const uint8_t* bytes = get_bytes(reader, 4);
+	return bytes ? read_f32_le(bytes) : 0.0f;
+}
+
+// ----------------------------------------------------------------------------
+// Saving
+
+// Share of the save spent on each step, for progress reports
+#define PROGRESS_LAYERS 0.3f
+#define PROGRESS_TEXTURES 0.5f
+
+typedef struct
+{
+	SaveProgress callback;
+	void* context;
+} Progress;
+
+static void report_progress(const Progress* progress, float value)
+{
+	if (progress->callback)
+		progress->callback(progress->context, value);
+}
+
+typedef struct
+{
+	SectionEntry* items;
+	size_t size;
+	size_t capacity;
+} SectionEntries;
+
+// Sections are written one after the other into body, offsets are fixed up once the table size is known
+static void begin_section(SectionEntries* sections, const ByteBuffer* body, SectionType type, uint32_t layer)
+{
+	SectionEntry entry = { .type = type, .layer = layer, .offset = body->size };
+	da_append(*sections, entry);
+}
+
+static void end_section(SectionEntries* sections, const ByteBuffer* body)
+{
+	SectionEntry* entry = &sections->items[sections->size - 1];
+	entry->size = body->size - entry->offset;
+}
+
+static void write_chunks(ByteBuffer* body, const TileGrid* grid)
+{
+	put_u32(body, (uint32_t)grid->size);
+	buffer_reserve(body, grid->size * CHUNK_HEADER_SIZE + grid->tile_count * CELL_SIZE);
+
+	for (size_t i = 0; i < grid->capacity; i++)
+	{
+		const Chunk* chunk = grid->items[i];
+		if (!chunk)
+			continue;
+
+		put_u32(body, (uint32_t)chunk->position.x);
+		put_u32(body, (uint32_t)chunk->position.y);
+		for (int y = 0; y < CHUNK_SIZE; y++)
+			put_u32(body, chunk->occupied[y]);
+
+		for (int y = 0; y < CHUNK_SIZE; y++)
+		{
+			for (int x = 0; x < CHUNK_SIZE; x++)
+			{
+				if (!chunk_has_tile(chunk, x, y))
+					continue;
+
+				int cell = y * CHUNK_SIZE + x;
+				put_u32(body, chunk->textures[cell]);
+				put_color(body, chunk->tint_palette[chunk->tints[cell]]);
+			}
+		}
+	}
+}
+
+static void write_static_tiles(ByteBuffer* body, const Tiles* tiles)
+{
+	put_u32(body, (uint32_t)tiles->size);
+	buffer_reserve(body, tiles->size * STATIC_TILE_SIZE);
+
+	for (size_t i = 0; i < tiles->size; i++)
+	{
+		Tile tile = tiles->items[i];
+		put_f32(body, tile.bounds.x);
+		put_f32(body, tile.bounds.y);
+		put_f32(body, tile.bounds.width);
+		put_f32(body, tile.bounds.height);
+		put_u32(body, (uint32_t)tile.texture_index);
+		put_color(body, tile.tint);
+	}
+}
+
+static void write_layer(SectionEntries* sections, ByteBuffer* body, const Layer* layer, uint32_t layer_index)
+{
+	begin_section(sections, body, SECTION_LAYER, layer_index);
+	put_f32(body, layer->offset.x);
+	put_f32(body, layer->offset.y);
+	end_section(sections, body);
+
+	if (layer->tiles.size > 0)
+	{
+		begin_section(sections, body, SECTION_CHUNKS, layer_index);
+		write_chunks(body, &layer->tiles);
+		end_section(sections, body);
+	}
+
+	if (layer->static_tiles.size > 0)
+	{
+		begin_section(sections, body, SECTION_STATIC_TILES, layer_index);
+		write_static_tiles(body, &layer->static_tiles);
+		end_section(sections, body);
+	}
+}
+
+// One unique image of the tilemap while saving
+typedef struct
+{
+	Image image;
+	uint64_t hash;
+	uint32_t encoding;
+	uint8_t* encoded; // QOI data, NULL when stored raw
+	size_t encoded_size;
+} SaveImage;
+
+typedef struct
+{
+	SaveImage* items;
+	size_t size;
+	size_t capacity;
+} SaveImages;
+
+// FNV-1a over the size and the pixels
+static uint64_t hash_image(Image image)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint32_t size[2] = { (uint32_t)image.width, (uint32_t)image.height };
+	const uint8_t* bytes = (const uint8_t*)size;
+	for (size_t i = 0; i < sizeof(size); i++)
+		hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+
+	bytes = image.data;
+	size_t count = (size_t)image.width * image.height * 4;
+	for (size_t i = 0; i < count; i++)
+		hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+
+	return hash;
+}
+
+static bool image_equals(Image a, Image b)
+{
+	return a.width == b.width && a.height == b.height &&
+		memcmp(a.data, b.data, (size_t)a.width * a.height * 4) == 0;
+}
+
+// Keeps QOI only when it is smaller than the raw pixels
+static void encode_image_job(void* context, size_t index)
+{
+	SaveImage* image = &((SaveImages*)context)->items[index];
+	size_t raw_size = (size_t)image->image.width * image->image.height * 4;
+
+	image->encoding = TEXTURE_ENCODING_RGBA8;
+	image->encoded = malloc(QOI_MAX_SIZE(image->image.width, image->image.height));
+	if (!image->encoded)
+		return;
+
+	image->encoded_size = qoi_encode(image->image.data, image->image.width, image->image.height, image->encoded);
+	if (image->encoded_size < raw_size)
+	{
+		image->encoding = TEXTURE_ENCODING_QOI;
+		return;
+	}
+
+	free(image->encoded);
+	image->encoded = NULL;
+}
+
+// Identical tile images (tilesets added twice, empty tiles) are stored once and
+// referenced from the texture table, unique images are encoded in parallel
+static void write_textures(SectionEntries* sections, ByteBuffer* body, const Tilemap* tilemap, const Progress* progress)
+{
+	size_t texture_count = tilemap->textures.size;
+	SaveImages images = {0};
+	uint32_t* texture_images = malloc((texture_count + 1) * sizeof(uint32_t));
+
+	// Hash set of image indices + 1 (0 is empty)
+	size_t capacity = 16;
+	while (capacity < texture_count * 2)
+		capacity *= 2;
+	uint32_t* slots = calloc(capacity, sizeof(uint32_t));
+	if (!texture_images || !slots)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		body->error = true;
+		goto return_defer;
+	}
+
+	for (size_t i = 0; i < texture_count; i++)
+	{
+		// Atlas pages are R8G8B8A8, so is the copy
+		Image image = atlas_get_image(&tilemap->atlas, tilemap->textures.items[i]);
+		uint64_t hash = hash_image(image);
+
+		size_t slot = hash & (capacity - 1);
+		while (slots[slot] != 0)
+		{
+			const SaveImage* other = &images.items[slots[slot] - 1];
+			if (other->hash == hash && image_equals(other->image, image))
+				break;
+			slot = (slot + 1) & (capacity - 1);
+		}
+
+		if (slots[slot] != 0)
+		{
+			UnloadImage(image);
+		}
+		else
+		{
+			SaveImage entry = { .image = image, .hash = hash };
+			da_append(images, entry);
+			slots[slot] = (uint32_t)images.size;
+		}
+
+		texture_images[i] = slots[slot] - 1;
+	}
+
+	report_progress(progress, PROGRESS_LAYERS + PROGRESS_TEXTURES * 0.2f);
+	TRACE_BEGIN("encode images");
+	parallel_for(images.size, encode_image_job, &images);
+	TRACE_END();
+	report_progress(progress, PROGRESS_LAYERS + PROGRESS_TEXTURES * 0.9f);
+
+	begin_section(sections, body, SECTION_IMAGES, 0);
+	put_u32(body, (uint32_t)images.size);
+	for (size_t i = 0; i < images.size; i++)
+	{
+		const SaveImage* image = &images.items[i];
+		bool raw = image->encoding == TEXTURE_ENCODING_RGBA8;
+		uint64_t size = raw ? (uint64_t)image->image.width * image->image.height * 4 : image->encoded_size;
+
+		put_u32(body, (uint32_t)image->image.width);
+		put_u32(body, (uint32_t)image->image.height);
+		put_u32(body, image->encoding);
+		put_u32(body, 0);
+		put_u64(body, size);
+		put_bytes(body, raw ? image->image.data : image->encoded, size);
+	}
+	end_section(sections, body);
+
+	begin_section(sections, body, SECTION_TEXTURE_IMAGES, 0);
+	put_u32(body, (uint32_t)texture_count);
+	for (size_t i = 0; i < texture_count; i++)
+		put_u32(body, texture_images[i]);
+	end_section(sections, body);
+
+return_defer:
+	for (size_t i = 0; i < images.size; i++)
+	{
+		UnloadImage(images.items[i].image);
+		free(images.items[i].encoded);
+	}
+	free(images.items);
+	free(texture_images);
+	free(slots);
+}
+
+static void write_tilesets(SectionEntries* sections, ByteBuffer* body, const Tilesets* tilesets)
+{
+	if (tilesets->size == 0)
+		return;
+
+	begin_section(sections, body, SECTION_TILESETS, 0);
+	put_u32(body, (uint32_t)tilesets->size);
+	for (size_t i = 0; i < tilesets->size; i++)
+	{
+		const Tileset* tileset = &tilesets->items[i];
+		size_t name_size = strlen(tileset->name);
+
+		put_u32(body, (uint32_t)tileset->first_texture);
+		put_u32(body, (uint32_t)tileset->texture_count);
+		put_u32(body, (uint32_t)name_size);
+		put_bytes(body, tileset->name, name_size);
+	}
+	end_section(sections, body);
+}
+
+// Writes in blocks of at most this size, retrying partial writes
+#define WRITE_BLOCK_SIZE (4 * 1024 * 1024)
+
+static bool write_all(int fd, const uint8_t* data, size_t size, const Progress* progress, size_t* done, size_t total)
+{
+	while (size > 0)
+	{
+		float fraction = (float)*done / total;
+		report_progress(progress, PROGRESS_LAYERS + PROGRESS_TEXTURES + (1.0f - PROGRESS_LAYERS - PROGRESS_TEXTURES) * fraction);
+
+		size_t block = size < WRITE_BLOCK_SIZE ? size : WRITE_BLOCK_SIZE;
+		ssize_t written = write(fd, data, block);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		data += written;
+		size -= written;
+		*done += written;
+	}
+
+	return true;
+}
+
+// Makes the rename itself durable
+static void sync_parent_directory(const char* filepath)
+{
+	char directory[PATH_MAX];
+	const char* slash = strrchr(filepath, '/');
+	if (!slash)
+		strcpy(directory, ".");
+	else if (slash == filepath)
+		strcpy(directory, "/");
+	else if ((size_t)(slash - filepath) < sizeof(directory))
+		snprintf(directory, sizeof(directory), "%.*s", (int)(slash - filepath), filepath);
+	else
+		return;
+
+	int fd = open(directory, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return;
+
+	fsync(fd);
+	close(fd);
+}
+
+// Writes the parts to a temporary file next to filepath and renames it over filepath once
+// everything is on disk, so a failed or interrupted save leaves the previous file intact
+static bool write_file_atomic(const char* filepath, const ByteBuffer* const* parts, size_t count, const Progress* progress)
+{
+	char temp_path[PATH_MAX];
+	if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", filepath) >= (int)sizeof(temp_path))
+	{
+		fprintf(stderr, "ERROR: The path %s is too long\n", filepath);
+		return false;
+	}
+
+	int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+	{
+		fprintf(stderr, "ERROR: Could not open %s: %s\n", temp_path, strerror(errno));
+		return false;
+	}
+
+	size_t done = 0;
+	size_t total = 0;
+	for (size_t i = 0; i < count; i++)
+		total += parts[i]->size;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!write_all(fd, parts[i]->items, parts[i]->size, progress, &done, total))
+		{
+			fprintf(stderr, "ERROR: Could not write %s: %s\n", temp_path, strerror(errno));
+			close(fd);
+			unlink(temp_path);
+			return false;
+		}
+	}
+
+	if (fsync(fd) != 0)
+	{
+		fprintf(stderr, "ERROR: Could not write %s: %s\n", temp_path, strerror(errno));
+		close(fd);
+		unlink(temp_path);
+		return false;
+	}
+
+	if (close(fd) != 0)
+	{
+		fprintf(stderr, "ERROR: Could not write %s: %s\n", temp_path, strerror(errno));
+		unlink(temp_path);
+		return false;
+	}
+
+	if (rename(temp_path, filepath) != 0)
+	{
+		fprintf(stderr, "ERROR: Could not replace %s: %s\n", filepath, strerror(errno));
+		unlink(temp_path);
+		return false;
+	}
+
+	sync_parent_directory(filepath);
+	return true;
+}
+
+bool save_tilemap(const Tilemap* tilemap, const char* filepath)
+{
+	return save_tilemap_with_progress(tilemap, filepath, NULL, NULL);
+}
+
+bool save_tilemap_with_progress(const Tilemap* tilemap, const char* filepath, SaveProgress callback, void* context)
+{
+	if (!tilemap)
+		return false;
+
+	TRACE_BEGIN("save_tilemap");
+	Progress progress = { .callback = callback, .context = context };
+	report_progress(&progress, 0.0f);
+
+	bool result = true;
+	SectionEntries sections = {0};
+	ByteBuffer body = {0};
+	ByteBuffer header = {0};
+
+	begin_section(&sections, &body, SECTION_TILEMAP, 0);
+	put_f32(&body, tilemap->offset.x);
+	put_f32(&body, tilemap->offset.y);
+	put_u32(&body, (uint32_t)tilemap->layers.size);
+	put_u32(&body, (uint32_t)tilemap->textures.size);
+	end_section(&sections, &body);
+
+	size_t total_tiles = tilemap->main_layer.tiles.tile_count + 1;
+	for (size_t i = 0; i < tilemap->layers.size; i++)
+		total_tiles += tilemap->layers.items[i].tiles.tile_count;
+
+	TRACE_BEGIN("write layers");
+	write_layer(&sections, &body, &tilemap->main_layer, 0);
+	size_t written_tiles = tilemap->main_layer.tiles.tile_count;
+	for (size_t i = 0; i < tilemap->layers.size; i++)
+	{
+		report_progress(&progress, PROGRESS_LAYERS * written_tiles / total_tiles);
+		write_layer(&sections, &body, &tilemap->layers.items[i], (uint32_t)(i + 1));
+		written_tiles += tilemap->layers.items[i].tiles.tile_count;
+	}
+	TRACE_END();
+
+	report_progress(&progress, PROGRESS_LAYERS);
+	TRACE_BEGIN("write textures");
+	write_textures(&sections, &body, tilemap, &progress);
+	write_tilesets(&sections, &body, &tilemap->tilesets);
+	TRACE_END();
+
+	uint64_t body_offset = TILEMAP_FILE_HEADER_SIZE + sections.size * TILEMAP_FILE_SECTION_ENTRY_SIZE;
+	put_bytes(&header, TILEMAP_FILE_MAGIC, 4);
+	put_u32(&header, TILEMAP_FILE_VERSION);
+	put_u32(&header, (uint32_t)sections.size);
+	put_u32(&header, 0);
+	for (size_t i = 0; i < sections.size; i++)
+	{
+		put_u32(&header, sections.items[i].type);
+		put_u32(&header, sections.items[i].layer);
+		put_u64(&header, body_offset + sections.items[i].offset);
+		put_u64(&header, sections.items[i].size);
+	}
+
+	if (header.error || body.error)
+	{
+		result = false;
+		goto return_defer;
+	}
+
+	const ByteBuffer* parts[] = { &header, &body };
+	TRACE_BEGIN("write file");
+	result = write_file_atomic(filepath, parts, sizeof(parts) / sizeof(parts[0]), &progress);
+	TRACE_END();
+	if (result)
+		report_progress(&progress, 1.0f);
+
+return_defer:
+	free(sections.items);
+	free(body.items);
+	free(header.items);
+	TRACE_END();
+	return result;
+}
+
+// ----------------------------------------------------------------------------
+// Loading version 2 and later, sections in any order
+
+static bool read_chunks(Reader* reader, TileGrid* grid)
+{
+	uint32_t chunk_count = get_u32(reader);
+	if (reader->error || chunk_count > (reader->size - reader->position) / CHUNK_HEADER_SIZE)
+		return false;
+
+	tile_grid_reserve(grid, grid->size + chunk_count);
+	for (uint32_t i = 0; i < chunk_count; i++)
+	{
+		const uint8_t* header = get_bytes(reader, CHUNK_HEADER_SIZE);
+		if (!header)
+			return false;
+
+		Vec2i position = { (int32_t)read_u32_le(header), (int32_t)read_u32_le(header + 4) };
+		Chunk* chunk = tile_grid_add_chunk(grid, position);
+		if (!chunk)
+			return false;
+
+		for (int y = 0; y < CHUNK_SIZE; y++)
+		{
+			uint32_t row = read_u32_le(header + 8 + 4 * y);
+			if (CHUNK_SIZE < 32)
+				row &= (1u << (CHUNK_SIZE % 32)) - 1;
+
+			const uint8_t* cells = get_bytes(reader, (size_t)__builtin_popcount(row) * CELL_SIZE);
+			if (!cells)
+				return false;
+
+			uint32_t added = row & ~chunk->occupied[y];
+			chunk->occupied[y] |= row;
+			chunk->tile_count += __builtin_popcount(added);
+			grid->tile_count += __builtin_popcount(added);
+
+			for (uint32_t bits = row; bits != 0; bits &= bits - 1)
+			{
+				chunk_set_cell(chunk, __builtin_ctz(bits), y, read_u32_le(cells), (Color){ cells[4], cells[5], cells[6], cells[7] });
+				cells += CELL_SIZE;
+			}
+		}
+
+		chunk->revision++;
+	}
+
+	grid->revision++;
+	return true;
+}
+
+static bool read_static_tiles(Reader* reader, Layer* layer)
+{
+	uint32_t count = get_u32(reader);
+	if (reader->error || count > (reader->size - reader->position) / STATIC_TILE_SIZE)
+		return false;
+
+	da_reserve(layer->static_tiles, layer->static_tiles.size + count);
+	const uint8_t* bytes = get_bytes(reader, (size_t)count * STATIC_TILE_SIZE);
+	for (uint32_t i = 0; i < count; i++, bytes += STATIC_TILE_SIZE)
+	{
+		Tile* tile = &layer->static_tiles.items[layer->static_tiles.size++];
+		*tile = (Tile){0};
+
+		tile->bounds.x = read_f32_le(bytes);
+		tile->bounds.y = read_f32_le(bytes + 4);
+		tile->bounds.width = read_f32_le(bytes + 8);
+		tile->bounds.height = read_f32_le(bytes + 12);
+		tile->texture_index = read_u32_le(bytes + 16);
+		tile->tint = (Color){ bytes[20], bytes[21], bytes[22], bytes[23] };
+	}
+
+	rebuild_static_index(layer);
+	return !reader->error;
+}
+
+// An image of SECTION_IMAGES (or SECTION_TEXTURES) while loading
+typedef struct
+{
+	int width;
+	int height;
+	uint32_t encoding;
+	const uint8_t* data; // In the mapped file
+	uint64_t size;
+	uint8_t* pixels; // Decoded R8G8B8A8 pixels, owned unless they are data itself
+	bool decoded;
+} FileImage;
+
+typedef struct
+{
+	FileImage* items;
+	size_t size;
+	size_t capacity;
+} FileImages;
+
+static void decode_image_job(void* context, size_t index)
+{
+	FileImage* image = &((FileImages*)context)->items[index];
+	if (image->encoding == TEXTURE_ENCODING_RGBA8)
+	{
+		image->pixels = (uint8_t*)image->data;
+		image->decoded = true;
+		return;
+	}
+
+	image->pixels = malloc((size_t)image->width * image->height * 4);
+	if (image->pixels)
+		image->decoded = qoi_decode(image->data, image->size, image->width, image->height, image->pixels);
+}
+
+// Reads the image headers, then decodes all images in parallel
+static bool read_images(Reader* reader, FileImages* images)
+{
+	uint32_t count = get_u32(reader);
+	if (reader->error || count > (reader->size - reader->position) / TEXTURE_HEADER_SIZE)
+		return false;
+
+	da_reserve(*images, count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t width = get_u32(reader);
+		uint32_t height = get_u32(reader);
+		uint32_t encoding = get_u32(reader);
+		get_u32(reader);
+		uint64_t size = get_u64(reader);
+		if (reader->error)
+			return false;
+
+		bool valid = width > 0 && height > 0 && width <= INT16_MAX && height <= INT16_MAX;
+		if (encoding == TEXTURE_ENCODING_RGBA8)
+			valid = valid && size == (uint64_t)width * height * 4;
+		else if (encoding != TEXTURE_ENCODING_QOI)
+			valid = false;
+
+		if (!valid)
+		{
+			fprintf(stderr, "ERROR: Unsupported image %u: encoding %u, %ux%u, %llu bytes\n",
+				i, encoding, width, height, (unsigned long long)size);
+			return false;
+		}
+
+		const uint8_t* data = get_bytes(reader, size);
+		if (!data)
+			return false;
+
+		FileImage image = { .width = (int)width, .height = (int)height, .encoding = encoding, .data = data, .size = size };
+		images->items[images->size++] = image;
+	}
+
+	TRACE_BEGIN("decode images");
+	parallel_for(images->size, decode_image_job, images);
+	TRACE_END();
+
+	for (size_t i = 0; i < images->size; i++)
+	{
+		if (!images->items[i].decoded)
+		{
+			fprintf(stderr, "ERROR: Could not decode image %zu\n", i);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void free_file_images(FileImages* images)
+{
+	for (size_t i = 0; i < images->size; i++)
+	{
+		if (images->items[i].pixels != images->items[i].data)
+			free(images->items[i].pixels);
+	}
+	free(images->items);
+	*images = (FileImages){0};
+}
+
+// Adds a texture per entry of the texture table, textures sharing an image share its atlas region.
+// Without a table (version 2) every image is its own texture.
+static bool add_file_textures(Tilemap* tilemap, const FileImages* images, Reader* table)
+{
+	uint32_t count = table ? get_u32(table) : (uint32_t)images->size;
+	if (table && (table->error || count > (table->size - table->position) / 4))
+		return false;
+
+	long* first_texture = malloc((images->size + 1) * sizeof(long));
+	if (!first_texture)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return false;
+	}
+	for (size_t i = 0; i < images->size; i++)
+		first_texture[i] = -1;
+
+	bool result = true;
+	da_reserve(tilemap->textures, tilemap->textures.size + count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t image_index = table ? get_u32(table) : i;
+		if (image_index >= images->size)
+		{
+			fprintf(stderr, "ERROR: Texture %u refers to image %u, there are %zu\n", i, image_index, images->size);
+			result = false;
+			break;
+		}
+
+		if (first_texture[image_index] >= 0)
+		{
+			// Same cap as add_texture, cells can't address more
+			if (tilemap->textures.size >= TILEMAP_MAX_TEXTURES)
+			{
+				fprintf(stderr, "ERROR: A tilemap can't hold more than %d textures\n", TILEMAP_MAX_TEXTURES);
+				result = false;
+				break;
+			}
+
+			da_append(tilemap->textures, tilemap->textures.items[first_texture[image_index]]);
+			tilemap->revision++;
+			continue;
+		}
+
+		const FileImage* file_image = &images->items[image_index];
+		Image image =
+		{
+			.data = file_image->pixels,
+			.width = file_image->width,
+			.height = file_image->height,
+			.mipmaps = 1,
+			.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+		};
+
+		// The atlas copies the pixels, they may point straight into the file
+		if (!add_texture(tilemap, image))
+		{
+			result = false;
+			break;
+		}
+		first_texture[image_index] = (long)tilemap->textures.size - 1;
+	}
+
+	free(first_texture);
+	return result;
+}
+
+// Needs the textures, tilesets outside of them are dropped
+static bool read_tilesets(Reader* reader, Tilemap* tilemap)
+{
+	uint32_t count = get_u32(reader);
+	for (uint32_t i = 0; i < count && !reader->error; i++)
+	{
+		uint32_t first_texture = get_u32(reader);
+		uint32_t texture_count = get_u32(reader);
+		uint32_t name_size = get_u32(reader);
+		const uint8_t* name = get_bytes(reader, name_size);
+		if (reader->error)
+			break;
+
+		if (texture_count == 0 || first_texture >= tilemap->textures.size || texture_count > tilemap->textures.size - first_texture)
+			continue;
+
+		Tileset tileset =
+		{
+			.name = malloc((size_t)name_size + 1),
+			.first_texture = first_texture,
+			.texture_count = texture_count,
+		};
+		if (!tileset.name)
+		{
+			fprintf(stderr, "ERROR: Could not allocate enough space\n");
+			return false;
+		}
+		memcpy(tileset.name, name, name_size);
+		tileset.name[name_size] = '\0';
+
+		da_append(tilemap->tilesets, tileset);
+	}
+
+	return !reader->error;
+}
+
+// Sections holding the bulk of the data, each parsed by its own job
+typedef struct
+{
+	SectionType type;
+	uint32_t section; // Index in the section table
+	Reader reader;
+	Layer* layer; // NULL for images
+	bool ok;
+} SectionJob;
+
+typedef struct
+{
+	SectionJob* items;
+	size_t size;
+	size_t capacity;
+	FileImages* images;
+} SectionJobs;
+
+static void read_section_job(void* context, size_t index)
+{
+	SectionJobs* jobs = context;
+	SectionJob* job = &jobs->items[index];
+
+	TRACE_BEGIN("read section");
+	if (job->type == SECTION_CHUNKS)
+		job->ok = read_chunks(&job->reader, &job->layer->tiles);
+	else if (job->type == SECTION_STATIC_TILES)
+		job->ok = read_static_tiles(&job->reader, job->layer);
+	else
+		job->ok = read_images(&job->reader, jobs->images);
+	TRACE_END();
+}
+
+// Jobs can run in parallel when no two of them write the same thing,
+// which is always the case for files this program writes
+static bool section_jobs_independent(const SectionJobs* jobs)
+{
+	for (size_t i = 0; i < jobs->size; i++)
+	{
+		for (size_t j = i + 1; j < jobs->size; j++)
+		{
+			const SectionJob* a = &jobs->items[i];
+			const SectionJob* b = &jobs->items[j];
+			bool both_images = !a->layer && !b->layer;
+			if (both_images || (a->type == b->type && a->layer == b->layer))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// Static tiles are read before the textures are known, drops the ones whose texture doesn't exist
+static size_t remove_invalid_static_tiles(Layer* layer, size_t texture_count)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < layer->static_tiles.size; i++)
+	{
+		if (layer->static_tiles.items[i].texture_index < texture_count)
+			layer->static_tiles.items[kept++] = layer->static_tiles.items[i];
+	}
+
+	size_t removed = layer->static_tiles.size - kept;
+	if (removed > 0)
+	{
+		layer->static_tiles.size = kept;
+		rebuild_static_index(layer);
+	}
+
+	return removed;
+}
+
+static Layer* get_file_layer(Tilemap* tilemap, uint32_t layer)
+{
+	if (layer == 0)
+		return &tilemap->main_layer;
+	if (layer - 1 < tilemap->layers.size)
+		return &tilemap->layers.items[layer - 1];
+
+	return NULL;
+}
+
+static bool load_tilemap_v2(const uint8_t* data, size_t size, Tilemap* result)
+{
+	Reader reader = { .data = data, .size = size, .position = 8 };
+	uint32_t section_count = get_u32(&reader);
+	get_u32(&reader);
+	if (reader.error || section_count > (size - reader.position) / TILEMAP_FILE_SECTION_ENTRY_SIZE)
+	{
+		fprintf(stderr, "ERROR: The section table is truncated\n");
+		return false;
+	}
+
+	SectionEntry* sections = malloc(section_count * sizeof(SectionEntry));
+	if (section_count > 0 && !sections)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return false;
+	}
+
+	bool ok = true;
+	bool has_tilemap = false;
+	for (uint32_t i = 0; i < section_count; i++)
+	{
+		sections[i].type = get_u32(&reader);
+		sections[i].layer = get_u32(&reader);
+		sections[i].offset = get_u64(&reader);
+		sections[i].size = get_u64(&reader);
+
+		if (sections[i].offset > size || sections[i].size > size - sections[i].offset)
+		{
+			fprintf(stderr, "ERROR: Section %u lies outside of the file\n", i);
+			ok = false;
+		}
+		if (sections[i].type == SECTION_TILEMAP)
+			has_tilemap = true;
+	}
+
+	if (ok && !has_tilemap)
+	{
+		fprintf(stderr, "ERROR: The file has no tilemap section\n");
+		ok = false;
+	}
+
+	// The tilemap section first, it tells how many layers the other sections refer to
+	for (uint32_t i = 0; ok && i < section_count; i++)
+	{
+		if (sections[i].type != SECTION_TILEMAP)
+			continue;
+
+		Reader section = { .data = data + sections[i].offset, .size = sections[i].size };
+		result->offset.x = get_f32(&section);
+		result->offset.y = get_f32(&section);
+		uint32_t layer_count = get_u32(&section);
+		uint32_t texture_count = get_u32(&section);
+		ok = !section.error;
+		if (!ok)
+			break;
+
+		// Every layer has its own section, more layers than sections is corrupted
+		if (layer_count > section_count)
+		{
+			fprintf(stderr, "ERROR: The file claims %u layers but only has %u sections\n", layer_count, section_count);
+			ok = false;
+			break;
+		}
+
+		da_reserve(result->layers, layer_count);
+		for (uint32_t j = 0; j < layer_count; j++)
+			result->layers.items[j] = (Layer){0};
+		result->layers.size = layer_count;
+		if (texture_count <= size / TEXTURE_HEADER_SIZE)
+			da_reserve(result->textures, texture_count);
+		break;
+	}
+
+	FileImages images = {0};
+	SectionJobs jobs = { .images = &images };
+	Reader texture_table = {0};
+	bool has_texture_table = false;
+	Reader tilesets = {0};
+	bool has_tilesets = false;
+	for (uint32_t i = 0; ok && i < section_count; i++)
+	{
+		Reader section = { .data = data + sections[i].offset, .size = sections[i].size };
+		Layer* layer = get_file_layer(result, sections[i].layer);
+
+		switch (sections[i].type)
+		{
+		case SECTION_LAYER:
+			if (!layer)
+				break;
+			layer->offset.x = get_f32(&section);
+			layer->offset.y = get_f32(&section);
+			ok = !section.error;
+			break;
+		case SECTION_CHUNKS:
+		case SECTION_STATIC_TILES:
+			if (layer)
+				da_append(jobs, ((SectionJob){ .type = sections[i].type, .section = i, .reader = section, .layer = layer }));
+			break;
+		case SECTION_TEXTURES:
+		case SECTION_IMAGES:
+			da_append(jobs, ((SectionJob){ .type = sections[i].type, .section = i, .reader = section }));
+			break;
+		case SECTION_TEXTURE_IMAGES:
+			texture_table = section;
+			has_texture_table = true;
+			break;
+		case SECTION_TILESETS:
+			tilesets = section;
+			has_tilesets = true;
+			break;
+		default:
+			break;
+		}
+
+		if (!ok)
+			fprintf(stderr, "ERROR: Section %u (type %u) is corrupted\n", i, sections[i].type);
+	}
+
+	// Layers are parsed while the images decode
+	if (ok && section_jobs_independent(&jobs))
+		parallel_for(jobs.size, read_section_job, &jobs);
+	else if (ok)
+	{
+		for (size_t i = 0; i < jobs.size; i++)
+		{
+			read_section_job(&jobs, i);
+			if (!jobs.items[i].ok)
+				break;
+		}
+	}
+
+	for (size_t i = 0; ok && i < jobs.size; i++)
+	{
+		if (!jobs.items[i].ok)
+		{
+			fprintf(stderr, "ERROR: Section %u (type %u) is corrupted\n", jobs.items[i].section, jobs.items[i].type);
+			ok = false;
+		}
+	}
+	free(jobs.items);
+
+	TRACE_BEGIN("add textures");
+	if (ok && images.size > 0)
+		ok = add_file_textures(result, &images, has_texture_table ? &texture_table : NULL);
+	TRACE_END();
+	if (ok && has_tilesets && !read_tilesets(&tilesets, result))
+	{
+		fprintf(stderr, "ERROR: The tilesets section is corrupted\n");
+		ok = false;
+	}
+
+	free_file_images(&images);
+	free(sections);
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+// Loading version 1, host byte order and sizes
+
+#define V1_TILE_SIZE (sizeof(Vec2i) + sizeof(size_t) + sizeof(Color))
+#define V1_STATIC_TILE_SIZE (sizeof(Rectangle) + sizeof(size_t) + sizeof(Color))
+
+static void get_native(Reader* reader, void* result, size_t size)
+{
+	const uint8_t* bytes = get_bytes(reader, size);
+	if (bytes)
+		memcpy(result, bytes, size);
+	else
+		memset(result, 0, size);
+}
+
+// Counts are checked against the remaining data before anything is allocated for them
+static size_t get_v1_count(Reader* reader, size_t element_size)
+{
+	size_t result = 0;
+	get_native(reader, &result, sizeof(result));
+	if (!reader->error && result > (reader->size - reader->position) / element_size)
+		reader->error = true;
+
+	return reader->error ? 0 : result;
+}
+
+static Tile get_v1_tile(Reader* reader, bool is_static)
+{
+	Tile result = {0};
+	if (is_static)
+		get_native(reader, &result.bounds, sizeof(result.bounds));
+	else
+		get_native(reader, &result.tilemap_index, sizeof(result.tilemap_index));
+
+	get_native(reader, &result.texture_index, sizeof(result.texture_index));
+	get_native(reader, &result.tint, sizeof(result.tint));
+
+	return result;
+}
+
+static void read_v1_layer(Reader* reader, Layer* layer)
+{
+	get_native(reader, &layer->offset, sizeof(layer->offset));
+
+	size_t amount = get_v1_count(reader, V1_TILE_SIZE);
+	for (size_t i = 0; i < amount; i++)
+		tile_grid_set(&layer->tiles, get_v1_tile(reader, false));
+
+	amount = get_v1_count(reader, V1_STATIC_TILE_SIZE);
+	da_reserve(layer->static_tiles, amount);
+	for (size_t i = 0; i < amount; i++)
+		layer->static_tiles.items[layer->static_tiles.size++] = get_v1_tile(reader, true);
+	rebuild_static_index(layer);
+}
+
+static bool load_tilemap_v1(const uint8_t* data, size_t size, Tilemap* result)
+{
+	Reader reader = { .data = data, .size = size, .position = 4 };
+
+	get_native(&reader, &result->offset, sizeof(result->offset));
+	read_v1_layer(&reader, &result->main_layer);
+
+	// An empty layer is at least its offset and two counts
+	size_t amount = get_v1_count(&reader, sizeof(Vector2) + 2 * sizeof(size_t));
+	da_reserve(result->layers, amount);
+	for (size_t i = 0; i < amount && !reader.error; i++)
+	{
+		Layer* layer = &result->layers.items[result->layers.size++];
+		*layer = (Layer){0};
+		read_v1_layer(&reader, layer);
+	}
+
+	amount = get_v1_count(&reader, 3 * sizeof(int));
+	da_reserve(result->textures, amount);
+	for (size_t i = 0; i < amount && !reader.error; i++)
+	{
+		Image image = { .mipmaps = 1 };
+		get_native(&reader, &image.width, sizeof(image.width));
+		get_native(&reader, &image.height, sizeof(image.height));
+		get_native(&reader, &image.format, sizeof(image.format));
+		if (reader.error || image.width <= 0 || image.height <= 0)
+		{
+			reader.error = true;
+			break;
+		}
+
+		const uint8_t* pixels = get_bytes(&reader, GetPixelDataSize(image.width, image.height, image.format));
+		if (!pixels)
+			break;
+
+		image.data = (void*)pixels;
+		add_texture(result, image);
+	}
+
+	if (reader.error)
+		fprintf(stderr, "ERROR: The file is truncated or corrupted\n");
+
+	return !reader.error;
+}
+
+// ----------------------------------------------------------------------------
+
+typedef struct
+{
+	const uint8_t* data;
+	size_t size;
+} MappedFile;
+
+// The whole file is mapped read only, sections are decoded straight from the mapping
+static bool map_file(const char* filepath, MappedFile* result)
+{
+	int fd = open(filepath, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "ERROR: Could not open %s: %s\n", filepath, strerror(errno));
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		fprintf(stderr, "ERROR: Could not read %s: %s\n", filepath, strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	*result = (MappedFile){ .size = (size_t)info.st_size };
+	if (result->size == 0)
+	{
+		close(fd);
+		return true;
+	}
+
+	void* data = mmap(NULL, result->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "ERROR: Could not map %s: %s\n", filepath, strerror(errno));
+		return false;
+	}
+
+	// Sections are decoded front to back, let the kernel read ahead
+	madvise(data, result->size, MADV_SEQUENTIAL);
+	madvise(data, result->size, MADV_WILLNEED);
+	result->data = data;
+	return true;
+}
+
+static void unmap_file(MappedFile* file)
+{
+	if (file->data)
+		munmap((void*)file->data, file->size);
+	*file = (MappedFile){0};
+}
+
+bool load_tilemap_file(const char* filepath, Tilemap* result, TilemapFileInfo* info)
+{
+	*result = (Tilemap){0};
+	if (info)
+		*info = (TilemapFileInfo){0};
+
+	TRACE_BEGIN("load_tilemap");
+	MappedFile file;
+	if (!map_file(filepath, &file))
+	{
+		TRACE_END();
+		return false;
+	}
+
+	bool ok = false;
+	if (file.size < 8 || memcmp(file.data, TILEMAP_FILE_MAGIC, 4) != 0)
+	{
+		fprintf(stderr, "ERROR: The format of the file is not correct: expected magic: \"%s\", got \"%.*s\"\n",
+			TILEMAP_FILE_MAGIC, file.size < 4 ? (int)file.size : 4, file.data ? (const char*)file.data : "");
+		goto return_defer;
+	}
+
+	uint32_t file_version = read_u32_le(file.data + 4);
+	if (file_version < 2 || file_version > MAX_KNOWN_VERSION_BITS)
+	{
+		file_version = 1;
+		ok = load_tilemap_v1(file.data, file.size, result);
+	}
+	else if (file_version > TILEMAP_FILE_VERSION)
+	{
+		fprintf(stderr, "ERROR: %s was saved by a newer version (file format %u, supported up to %u)\n",
+			filepath, file_version, TILEMAP_FILE_VERSION);
+		ok = false;
+	}
+	else
+		ok = load_tilemap_v2(file.data, file.size, result);
+
+	if (info)
+		info->version = file_version;
+
+	if (!ok)
+	{
+		fprintf(stderr, "ERROR: Could not load %s\n", filepath);
+		unload_tilemap(result);
+		*result = (Tilemap){0};
+	}
+	else
+	{
+		size_t removed = remove_invalid_static_tiles(&result->main_layer, result->textures.size);
+		for (size_t i = 0; i < result->layers.size; i++)
+			removed += remove_invalid_static_tiles(&result->layers.items[i], result->textures.size);
+		if (removed > 0)
+			fprintf(stderr, "WARNING: %s has %zu static tiles with a texture that doesn't exist, they were left out\n", filepath, removed);
+		if (info)
+			info->dropped_static_tiles = removed;
+
+		TRACE_BEGIN("replay journal");
+		replay_journal(result, filepath);
+		TRACE_END();
+	}
+
+return_defer:
+	unmap_file(&file);
+	TRACE_END();
+	return ok;
+}
+
+Tilemap load_tilemap(const char* filepath)
+{
+	Tilemap result;
+	load_tilemap_file(filepath, &result, NULL);
+	return result;
+}
+
+// ----------------------------------------------------------------------------
+// Journal
+
+// Pending records are written once there are this many bytes of them, even without a flush
+#define JOURNAL_PENDING_LIMIT (1024 * 1024)
+
+static uint32_t hash_record(const uint8_t* record)
+{
+	uint32_t hash = 0x811c9dc5u;
+	for (size_t i = 0; i < JOURNAL_RECORD_SIZE - 4; i++)
+		hash = (hash ^ record[i]) * 0x01000193u;
+
+	return hash;
+}
+
+// Number of records before the first bad or incomplete one, 0 if the header is wrong
+static size_t count_valid_records(const uint8_t* data, size_t size)
+{
+	if (size < JOURNAL_HEADER_SIZE || memcmp(data, JOURNAL_MAGIC, 4) != 0 || read_u32_le(data + 4) != JOURNAL_VERSION)
+		return 0;
+
+	size_t result = 0;
+	const uint8_t* record = data + JOURNAL_HEADER_SIZE;
+	size_t count = (size - JOURNAL_HEADER_SIZE) / JOURNAL_RECORD_SIZE;
+	while (result < count && read_u32_le(record + JOURNAL_RECORD_SIZE - 4) == hash_record(record))
+	{
+		result++;
+		record += JOURNAL_RECORD_SIZE;
+	}
+
+	return result;
+}
+
+static char* get_journal_path(const char* tilemap_filepath)
+{
+	size_t length = strlen(tilemap_filepath) + sizeof(".journal");
+	char* result = malloc(length);
+	if (!result)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return NULL;
+	}
+
+	snprintf(result, length, "%s.journal", tilemap_filepath);
+	return result;
+}
+
+// Reads the whole journal, the result must be freed
+static uint8_t* read_journal(int fd, size_t* size)
+{
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+		return NULL;
+
+	*size = (size_t)info.st_size;
+	uint8_t* result = malloc(*size + 1);
+	if (!result)
+	{
+		fprintf(stderr, "ERROR: Could not allocate enough space\n");
+		return NULL;
+	}
+
+	size_t done = 0;
+	while (done < *size)
+	{
+		ssize_t amount = pread(fd, result + done, *size - done, done);
+		if (amount < 0 && errno == EINTR)
+			continue;
+		if (amount <= 0)
+			break;
+		done += amount;
+	}
+	*size = done;
+
+	return result;
+}
+
+bool journal_open(Journal* journal, const char* tilemap_filepath, uint64_t base_revision)
+{
+	journal_close(journal);
+
+	char* path = get_journal_path(tilemap_filepath);
+	if (!path)
+		return false;
+
+	int fd = open(path, O_RDWR | O_CREAT, 0666);
+	if (fd < 0)
+	{
+		fprintf(stderr, "ERROR: Could not open %s: %s\n", path, strerror(errno));
+		free(path);
+		return false;
+	}
+
+	// Drop what follows the last good record, so new records are not appended after garbage
+	size_t size = 0;
+	uint8_t* data = read_journal(fd, &size);
+	size_t valid = data ? count_valid_records(data, size) : 0;
+	bool has_header = data && size >= JOURNAL_HEADER_SIZE && memcmp(data, JOURNAL_MAGIC, 4) == 0 &&
+		read_u32_le(data + 4) == JOURNAL_VERSION;
+	free(data);
+
+	uint8_t header[JOURNAL_HEADER_SIZE] = { 'M', 'I', 'A', 'J', JOURNAL_VERSION, 0, 0, 0 };
+	uint64_t journal_size = JOURNAL_HEADER_SIZE + (uint64_t)valid * JOURNAL_RECORD_SIZE;
+	if (ftruncate(fd, has_header ? (off_t)journal_size : 0) != 0 ||
+		(!has_header && pwrite(fd, header, sizeof(header), 0) != sizeof(header)) ||
+		lseek(fd, 0, SEEK_END) < 0)
+	{
+		fprintf(stderr, "ERROR: Could not write %s: %s\n", path, strerror(errno));
+		close(fd);
+		free(path);
+		return false;
+	}
+
+	journal->path = path;
+	journal->fd = fd;
+	journal->size = journal_size;
+	journal->base_revision = base_revision;
+
+	return true;
+}
+
+void journal_close(Journal* journal)
+{
+	if (!journal)
+		return;
+
+	if (journal->path)
+	{
+		journal_flush(journal, true);
+		close(journal->fd);
+	}
+
+	free(journal->path);
+	free(journal->pending.items);
+	*journal = (Journal){0};
+}
+
+bool journal_accepts(const Journal* journal, const Tilemap* tilemap)
+{
+	return journal && journal->path && journal->base_revision == get_tilemap_structure_revision(tilemap);
+}
+
+static void record_cell(Journal* journal, uint32_t layer, Vec2i index, uint32_t texture_index, Color tint)
+{
+	if (!journal || !journal->path)
+		return;
+
+	ByteBuffer* pending = &journal->pending;
+	if (!buffer_reserve(pending, JOURNAL_RECORD_SIZE))
+		return;
+
+	const uint8_t* record = pending->items + pending->size;
+
+	put_u32(pending, layer);
+	put_u32(pending, (uint32_t)index.x);
+	put_u32(pending, (uint32_t)index.y);
+	put_u32(pending, texture_index);
+	put_color(pending, tint);
+	put_u32(pending, hash_record(record));
+
+	if (pending->size >= JOURNAL_PENDING_LIMIT)
+		journal_flush(journal, false);
+}
+
+void journal_record_set(Journal* journal, uint32_t layer, Tile tile)
+{
+	record_cell(journal, layer, tile.tilemap_index, (uint32_t)tile.texture_index, tile.tint);
+}
+
+void journal_record_erase(Journal* journal, uint32_t layer, Vec2i index)
+{
+	record_cell(journal, layer, index, JOURNAL_ERASED, (Color){0});
+}
+
+bool journal_flush(Journal* journal, bool sync)
+{
+	if (!journal || !journal->path)
+		return false;
+
+	if (journal->pending.error)
+	{
+		fprintf(stderr, "ERROR: Edits were lost from %s, save in full\n", journal->path);
+		journal->base_revision = UINT64_MAX;
+		journal->pending.error = false;
+		journal->pending.size = 0;
+	}
+
+	bool result = true;
+	if (journal->pending.size > 0)
+	{
+		size_t done = 0;
+		Progress progress = {0};
+		TRACE_BEGIN("write journal");
+		result = write_all(journal->fd, journal->pending.items, journal->pending.size, &progress, &done, journal->pending.size);
+		TRACE_END();
+		journal->size += done;
+		journal->pending.size = 0;
+	}
+
+	if (result && sync && fdatasync(journal->fd) != 0)
+		result = false;
+
+	if (!result)
+	{
+		// The file may end with a partial record now, the next edits must go to a full save
+		fprintf(stderr, "ERROR: Could not write %s: %s\n", journal->path, strerror(errno));
+		journal->base_revision = UINT64_MAX;
+	}
+
+	return result;
+}
+
+bool journal_compact(Journal* journal, uint64_t offset, const char* tilemap_filepath, uint64_t base_revision)
+{
+	if (!journal || !tilemap_filepath)
+		return false;
+
+	// Records written since the saved snapshot was taken are not part of the tilemap file
+	uint8_t* tail = NULL;
+	size_t tail_size = 0;
+	if (journal->path)
+	{
+		journal_flush(journal, false);
+
+		size_t size = 0;
+		uint8_t* data = read_journal(journal->fd, &size);
+		if (data)
+		{
+			size_t end = JOURNAL_HEADER_SIZE + count_valid_records(data, size) * JOURNAL_RECORD_SIZE;
+			if (offset < JOURNAL_HEADER_SIZE)
+				offset = JOURNAL_HEADER_SIZE;
+			if (offset < end)
+			{
+				tail_size = end - offset;
+				memmove(data, data + offset, tail_size);
+			}
+			tail = data;
+		}
+	}
+
+	char* path = get_journal_path(tilemap_filepath);
+	if (!path)
+	{
+		free(tail);
+		return false;
+	}
+
+	ByteBuffer header = {0};
+	put_bytes(&header, JOURNAL_MAGIC, 4);
+	put_u32(&header, JOURNAL_VERSION);
+	ByteBuffer records = { .items = tail, .size = tail_size, .capacity = tail_size };
+
+	const ByteBuffer* parts[] = { &header, &records };
+	Progress progress = {0};
+	bool result = !header.error && write_file_atomic(path, parts, sizeof(parts) / sizeof(parts[0]), &progress);
+
+	free(header.items);
+	free(tail);
+	free(path);
+
+	if (!result)
+	{
+		journal->base_revision = UINT64_MAX;
+		return false;
+	}
+
+	return journal_open(journal, tilemap_filepath, base_revision);
+}
+
+bool discard_journal(const char* tilemap_filepath)
+{
+	char* path = get_journal_path(tilemap_filepath);
+	if (!path)
+		return false;
+
+	bool result = unlink(path) == 0 || errno == ENOENT;
+	if (!result)
+		fprintf(stderr, "ERROR: Could not remove %s: %s\n", path, strerror(errno));
+
+	free(path);
+	return result;
+}
+
+size_t replay_journal(Tilemap* tilemap, const char* tilemap_filepath)
+{
+	char* path = get_journal_path(tilemap_filepath);
+	if (!path)
+		return 0;
+
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return 0;
+
+	size_t size = 0;
+	uint8_t* data = read_journal(fd, &size);
+	close(fd);
+	if (!data)
+		return 0;
+
+	size_t count = count_valid_records(data, size);
+	const uint8_t* record = data + JOURNAL_HEADER_SIZE;
+	for (size_t i = 0; i < count; i++, record += JOURNAL_RECORD_SIZE)
+	{
+		Layer* layer = get_file_layer(tilemap, read_u32_le(record));
+		if (!layer)
+			continue;
+
+		Vec2i index = { (int32_t)read_u32_le(record + 4), (int32_t)read_u32_le(record + 8) };
+		uint32_t texture_index = read_u32_le(record + 12);
+		if (texture_index == JOURNAL_ERASED)
+			tile_grid_erase(&layer->tiles, index);
+		else if (texture_index < tilemap->textures.size)
+		{
+			Tile tile =
+			{
+				.tilemap_index = index,
+				.texture_index = texture_index,
+				.tint = { record[16], record[17], record[18], record[19] },
+			};
+			tile_grid_set(&layer->tiles, tile);
+		}
+	}
+
+	free(data);
+	return count;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tilemap.h"
+
+// Tilemap file format, version 3
+//
+// Every field has a fixed width and is stored little endian, floats as their IEEE 754 bits.
+//
+//   Header          magic "MIAU", u32 version, u32 section_count, u32 reserved
+//   Section table   section_count entries of u32 type, u32 layer, u64 offset, u64 size
+//   Sections        at the offsets given by the table (from the start of the file)
+//
+// Layer 0 is the main layer, layer i + 1 is layers.items[i]. Readers skip unknown sections.
+//
+// Version 1 files (host byte order and sizes, no section table) have no version field:
+// the offset of the tilemap follows the magic. They are still loaded but never written.
+
+#define TILEMAP_FILE_MAGIC "MIAU"
+#define TILEMAP_FILE_VERSION 3
+
+#define TILEMAP_FILE_HEADER_SIZE 16
+#define TILEMAP_FILE_SECTION_ENTRY_SIZE 24
+
+typedef enum
+{
+	// f32 offset_x, f32 offset_y, u32 layer_count (without the main layer), u32 texture_count
+	SECTION_TILEMAP = 1,
+	// f32 offset_x, f32 offset_y
+	SECTION_LAYER = 2,
+	// u32 chunk_count, then per chunk: i32 x, i32 y, u32 occupied[CHUNK_SIZE],
+	// then for every occupied cell in row order: u32 texture_index, u8 r, g, b, a
+	SECTION_CHUNKS = 3,
+	// u32 tile_count, then per tile: f32 x, y, width, height, u32 texture_index, u8 r, g, b, a
+	SECTION_STATIC_TILES = 4,
+	// Version 2 only: u32 texture_count, then one image per texture (see SECTION_IMAGES)
+	SECTION_TEXTURES = 5,
+	// u32 image_count, then per image: u32 width, u32 height, u32 encoding, u32 reserved,
+	// u64 size, size bytes of pixels in the given TextureEncoding
+	SECTION_IMAGES = 6,
+	// u32 texture_count, then per texture: u32 index in SECTION_IMAGES
+	// Identical tile images are stored once and shared by every texture using them
+	SECTION_TEXTURE_IMAGES = 7,
+	// u32 tileset_count, then per tileset: u32 first_texture, u32 texture_count, u32 name_size,
+	// name_size bytes of name. Optional, files without it have textures of no tileset.
+	SECTION_TILESETS = 8,
+} SectionType;
+
+typedef enum
+{
+	TEXTURE_ENCODING_RGBA8 = 0, // Raw R8G8B8A8 pixels
+	TEXTURE_ENCODING_QOI = 1, // R8G8B8A8 pixels encoded with qoi_encode
+} TextureEncoding;
+
+typedef struct
+{
+	uint32_t type;
+	uint32_t layer;
+	uint64_t offset;
+	uint64_t size;
+} SectionEntry;
+
+// Edit journal, <tilemap file>.journal
+//
+//   Header    magic "MIAJ", u32 version
+//   Records   u32 layer, i32 x, i32 y, u32 texture_index, u8 r, g, b, a, u32 checksum
+//
+// Each record gives the new content of a grid cell, texture_index JOURNAL_ERASED erases it.
+// checksum is the FNV-1a hash of the first 20 bytes of the record. Replaying stops at the first
+// bad or incomplete record (an interrupted write). Records are absolute, so replaying records
+// that are already part of the tilemap file changes nothing.
+
+#define JOURNAL_MAGIC "MIAJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 8
+#define JOURNAL_RECORD_SIZE 24
+#define JOURNAL_ERASED UINT32_MAX
+
+typedef struct
+{
+	uint8_t* items;
+	size_t size;
+	size_t capacity;
+	bool error; // An allocation failed, the content is incomplete
+} ByteBuffer;
+
+// Appends the grid edits made since the tilemap file was last written in full, so saving after
+// small edits only has to write them and a crash only loses edits not flushed yet
+typedef struct
+{
+	char* path; // NULL when closed
+	int fd;
+	uint64_t size; // Bytes in the file
+	ByteBuffer pending; // Records not written yet
+	// get_tilemap_structure_revision the records apply to, other changes need a full save
+	uint64_t base_revision;
+} Journal;
+
+// Called from the saving thread with the fraction of the save done so far, in [0, 1]
+typedef void (*SaveProgress)(void* context, float progress);
+
+// save_tilemap reporting its progress, callback may be NULL
+bool save_tilemap_with_progress(const Tilemap* tilemap, const char* filepath, SaveProgress callback, void* context);
+
+// What load_tilemap_file found in the file besides the tilemap
+typedef struct
+{
+	uint32_t version; // Format version of the file
+	size_t dropped_static_tiles; // Static tiles using a texture that doesn't exist, left out
+} TilemapFileInfo;
+
+// load_tilemap telling whether it worked, info may be NULL
+bool load_tilemap_file(const char* filepath, Tilemap* result, TilemapFileInfo* info);
+
+// Opens the journal of the tilemap file for appending, creating it if needed
+bool journal_open(Journal* journal, const char* tilemap_filepath, uint64_t base_revision);
+// Writes the pending records before closing
+void journal_close(Journal* journal);
+// Whether edits of tilemap can be recorded, the journal must be open and no structure change happened
+bool journal_accepts(const Journal* journal, const Tilemap* tilemap);
+void journal_record_set(Journal* journal, uint32_t layer, Tile tile);
+void journal_record_erase(Journal* journal, uint32_t layer, Vec2i index);
+// Writes the pending records, with sync they are on disk when it returns
+bool journal_flush(Journal* journal, bool sync);
+// After the tilemap was written in full to tilemap_filepath: replaces its journal with the records
+// written after offset (the journal size when the saved snapshot was taken) and reopens it
+bool journal_compact(Journal* journal, uint64_t offset, const char* tilemap_filepath, uint64_t base_revision);
+// Deletes the journal of the tilemap file, after the file was rewritten without going through journal_compact
+bool discard_journal(const char* tilemap_filepath);
+// Applies the journal next to tilemap_filepath to tilemap, returns the number of records applied
+size_t replay_journal(Tilemap* tilemap, const char* tilemap_filepath);
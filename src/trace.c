@@ -0,0 +1,218 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct
+{
+	const char* name;
+	uint64_t start; // Nanoseconds since trace_init
+	uint64_t duration;
+} TraceEvent;
+
+typedef struct TraceBuffer
+{
+	struct TraceBuffer* next; // List of every buffer, they are never freed
+	int id; // Thread id in the trace
+	atomic_bool in_use;
+
+	// Written by the owning thread only, events[i % TRACE_BUFFER_EVENTS] for i < written
+	atomic_uint_fast64_t written;
+	TraceEvent events[TRACE_BUFFER_EVENTS];
+
+	// Spans begun and not ended yet
+	int depth;
+	const char* open_names[TRACE_MAX_DEPTH];
+	uint64_t open_starts[TRACE_MAX_DEPTH];
+} TraceBuffer;
+
+bool trace_enabled = false;
+
+static char* trace_filepath;
+static uint64_t trace_start;
+static _Atomic(TraceBuffer*) buffers;
+static atomic_int buffer_count;
+static pthread_key_t buffer_key;
+static _Thread_local TraceBuffer* thread_buffer;
+
+static uint64_t get_nanoseconds(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+// Called when a thread that recorded spans exits
+static void release_buffer(void* argument)
+{
+	TraceBuffer* buffer = argument;
+	buffer->depth = 0;
+	atomic_store(&buffer->in_use, false);
+}
+
+static TraceBuffer* get_thread_buffer(void)
+{
+	if (thread_buffer)
+		return thread_buffer;
+
+	// Reuse the buffer of a thread that exited
+	TraceBuffer* result = NULL;
+	for (TraceBuffer* buffer = atomic_load(&buffers); buffer && !result; buffer = buffer->next)
+	{
+		bool expected = false;
+		if (atomic_compare_exchange_strong(&buffer->in_use, &expected, true))
+			result = buffer;
+	}
+
+	if (!result)
+	{
+		result = calloc(1, sizeof(TraceBuffer));
+		if (!result)
+			return NULL;
+
+		result->id = atomic_fetch_add(&buffer_count, 1);
+		atomic_init(&result->in_use, true);
+		atomic_init(&result->written, 0);
+
+		result->next = atomic_load(&buffers);
+		while (!atomic_compare_exchange_weak(&buffers, &result->next, result))
+			;
+	}
+
+	pthread_setspecific(buffer_key, result);
+	thread_buffer = result;
+	return result;
+}
+
+void trace_init(const char* filepath)
+{
+	if (!filepath || trace_enabled)
+		return;
+
+	trace_filepath = strdup(filepath);
+	if (!trace_filepath || pthread_key_create(&buffer_key, release_buffer) != 0)
+	{
+		fprintf(stderr, "ERROR: Could not start tracing to %s\n", filepath);
+		free(trace_filepath);
+		trace_filepath = NULL;
+		return;
+	}
+
+	trace_start = get_nanoseconds();
+	trace_enabled = true;
+
+	// The calling thread gets the first buffer, it is named main in the trace
+	get_thread_buffer();
+}
+
+void trace_begin(const char* name)
+{
+	TraceBuffer* buffer = get_thread_buffer();
+	if (!buffer)
+		return;
+
+	if (buffer->depth < TRACE_MAX_DEPTH)
+	{
+		buffer->open_names[buffer->depth] = name;
+		buffer->open_starts[buffer->depth] = get_nanoseconds();
+	}
+	buffer->depth++;
+}
+
+void trace_end(void)
+{
+	TraceBuffer* buffer = get_thread_buffer();
+	if (!buffer || buffer->depth == 0)
+		return;
+
+	buffer->depth--;
+	if (buffer->depth >= TRACE_MAX_DEPTH)
+		return;
+
+	uint64_t now = get_nanoseconds();
+	TraceEvent event =
+	{
+		.name = buffer->open_names[buffer->depth],
+		.start = buffer->open_starts[buffer->depth] - trace_start,
+		.duration = now - buffer->open_starts[buffer->depth],
+	};
+
+	uint64_t index = atomic_load_explicit(&buffer->written, memory_order_relaxed);
+	buffer->events[index % TRACE_BUFFER_EVENTS] = event;
+	atomic_store_explicit(&buffer->written, index + 1, memory_order_release);
+}
+
+// Copies the events of buffer the owner didn't overwrite during the copy, returns their count
+static size_t copy_events(TraceBuffer* buffer, TraceEvent* result)
+{
+	uint64_t end = atomic_load_explicit(&buffer->written, memory_order_acquire);
+	uint64_t begin = end > TRACE_BUFFER_EVENTS ? end - TRACE_BUFFER_EVENTS : 0;
+	for (uint64_t i = begin; i < end; i++)
+		result[i - begin] = buffer->events[i % TRACE_BUFFER_EVENTS];
+
+	atomic_thread_fence(memory_order_acquire);
+	uint64_t written = atomic_load_explicit(&buffer->written, memory_order_relaxed);
+	uint64_t overwritten = written > TRACE_BUFFER_EVENTS ? written - TRACE_BUFFER_EVENTS : 0;
+	if (overwritten >= end)
+		return 0;
+	if (overwritten <= begin)
+		return (size_t)(end - begin);
+
+	size_t skipped = (size_t)(overwritten - begin);
+	memmove(result, result + skipped, (size_t)(end - overwritten) * sizeof(TraceEvent));
+	return (size_t)(end - overwritten);
+}
+
+bool trace_write(void)
+{
+	if (!trace_enabled)
+		return false;
+
+	TraceEvent* events = malloc(TRACE_BUFFER_EVENTS * sizeof(TraceEvent));
+	FILE* file = fopen(trace_filepath, "w");
+	if (!events || !file)
+	{
+		fprintf(stderr, "ERROR: Could not write the trace to %s\n", trace_filepath);
+		free(events);
+		if (file)
+			fclose(file);
+		return false;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	for (TraceBuffer* buffer = atomic_load(&buffers); buffer; buffer = buffer->next)
+	{
+		char thread_name[32];
+		if (buffer->id == 0)
+			snprintf(thread_name, sizeof(thread_name), "main");
+		else
+			snprintf(thread_name, sizeof(thread_name), "thread %d", buffer->id);
+
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			first ? "" : ",\n", buffer->id, thread_name);
+		first = false;
+
+		size_t count = copy_events(buffer, events);
+		for (size_t i = 0; i < count; i++)
+		{
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				events[i].name, buffer->id, events[i].start / 1000.0, events[i].duration / 1000.0);
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	bool result = !ferror(file);
+	if (fclose(file) != 0)
+		result = false;
+	if (!result)
+		fprintf(stderr, "ERROR: Could not write the trace to %s\n", trace_filepath);
+
+	free(events);
+	return result;
+}
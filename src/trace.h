@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Timed spans written as Chrome trace event JSON, to open in chrome://tracing or ui.perfetto.dev.
+// Off unless trace_init gets a file, every span is then a single branch on trace_enabled.
+// Each thread records into its own ring buffer of TRACE_BUFFER_EVENTS spans, the oldest are
+// overwritten. Threads take a buffer without locking and hand it to the next thread when they exit.
+
+#define TRACE_BUFFER_EVENTS (1 << 16)
+// Deeper nested spans are not recorded
+#define TRACE_MAX_DEPTH 32
+
+// Environment variable naming the trace file
+#define TRACE_ENV "TILEMAP_TRACE"
+
+extern bool trace_enabled;
+
+// name must stay valid until the trace is written, use string literals
+#define TRACE_BEGIN(name) do { if (trace_enabled) trace_begin(name); } while (0)
+#define TRACE_END() do { if (trace_enabled) trace_end(); } while (0)
+
+// Enables tracing to filepath, nothing when it is NULL. Call once, before starting other threads.
+void trace_init(const char* filepath);
+
+void trace_begin(const char* name);
+void trace_end(void);
+
+// Writes the spans still in the buffers to the trace file, they are kept, so every write holds
+// the latest spans of each thread. Spans recorded while writing may be left out.
+bool trace_write(void);
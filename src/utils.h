@@ -17,6 +17,17 @@
 		(da).items[(da).size++] = value;                                             \
 	} while (0)
 
+// Grows the capacity to at least amount items without changing the size
+#define da_reserve(da, amount)                                                       \
+	do                                                                               \
+	{                                                                                \
+		if ((amount) > (da).capacity)                                                \
+		{                                                                            \
+			(da).capacity = (amount);                                                \
+			(da).items = realloc((da).items, (da).capacity * sizeof((da).items[0])); \
+		}                                                                            \
+	} while (0)
+
 #define da_remove_at(da, index)                              \
 	do                                                       \
 	{                                                        \